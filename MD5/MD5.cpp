@@ -4,53 +4,89 @@
  * Implementation of the MD5 hash function. This program takes a message as input
  * and outputs the MD5 hash value of the message. The message can be given as a
  * string in the command line, or as a text file. The hash value can be written
- * to a file or to the console.
+ * to a file or to the console. The hashing itself is done by the MD5 library
+ * declared in libmd5.h; this file only handles the command line, files and output.
  * 
  */
 
+#include "libmd5.h"
+#include "md5_server.h"
+#include "../buffer_pool.h"
 #include "../io.h"
+#include "../thread_pool.h"
+#include "../digest_cache.h"
+#include "../stats.h"
+#include "../block_hash_cli.h"
 #include <iostream>
 #include <cassert>
-
-/* 
- * A table of constants used in the MD5 algorithm. These constants are used in
- * the main loop of the algorithm to update the state of the hash function.
- */
-static constexpr uint32_t K[64] = {
-    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
-    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
-    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
-    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
-    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
-    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
-    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
-    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
-    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
-    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
-    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
-    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
-    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
-    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
-    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
-    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
-};
-
-/* 
- * A table of shift amounts used in the MD5 algorithm. These shift amounts are
- * used in the main loop of the algorithm to update the state of the hash function.
- */
-static constexpr int S[64] = {
-    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
-    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
-    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
-    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
-};
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <random>
+#include <cstdlib>
+#include <filesystem>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <new>
+#include <thread>
 
 /* 
  * A usage string to be displayed if the user provides incorrect arguments.
  */
 static const std::string usage = "\nUsage:\nMD5 --message=\"...\" [--outputFile="
-    "\"...\"]\nOR\n" "MD5 --messageFile=\"...\" [--outputFile=\"...\"]\n";
+    "\"...\"]\nOR\n" "MD5 --messageFile=\"...\" [--outputFile=\"...\"]\nOR\n"
+    "MD5 --messageFile=\"...\" --resume=\"state.bin\" [--checkpointInterval=<bytes>]"
+    " [--outputFile=\"...\"]\nOR\n"
+    "MD5 --directory=\"...\" [--threads=<count>] [--outputFile=\"...\"]\nOR\n"
+    "MD5 --fileList=\"...\" [--threads=<count>] [--outputFile=\"...\"]\nOR\n"
+    "MD5 --check=\"manifest.md5\" [--failFast=true] [--strict=true] [--threads=<count>]\nOR\n"
+    "MD5 --dedupe=\"...\" [--threads=<count>] [--outputFile=\"...\"]\nOR\n"
+    "MD5 --daemon=<unix:path|tcp:host:port> [--daemonRoots=\"dir[:dir...]\"]"
+    " [--threads=<count>]\nOR\n"
+    "MD5 --messageFile=\"...\" --tree=true [--leafSize=<bytes>] [--threads=<count>]"
+    " [--leaves=\"...\" | --checkLeaves=\"...\"] [--outputFile=\"...\"]\nOR\n"
+    "MD5 --selfTest=<iterations>\nOR\n"
+    "MD5 --benchmark=<quick|full> [--outputFile=\"...\"]\n\n"
+    "A messageFile of \"-\" reads the message from standard input; it cannot be\n"
+    "resumed.\n"
+    "Any of the above can be combined with --engine=<name> to pin the MD5 engine\n"
+    "(the MD5_ENGINE environment variable does the same), with\n"
+    "--cache=\"...\" to skip hashing files that are unchanged since they were\n"
+    "last hashed in batch or check mode, with\n"
+    "--bufferSize=<bytes> to set the size of the read buffer (default 1 MiB),\n"
+    "with --queueDepth=<buffers> to read ahead that many buffers (at least 2) on\n"
+    "a separate I/O thread, with\n"
+    "--directIO=true to read files without going through the page cache (the\n"
+    "buffer size must be a multiple of 4096; combine it with --queueDepth so the\n"
+    "device is kept busy), and with\n"
+    "--stats=true to report bytes, blocks and the time spent reading, padding and\n"
+    "compressing on standard error. Reading a memory-mapped file happens as the\n"
+    "pages are touched, so it is counted as compressing.\n\n"
+    "With --key=\"...\" or --keyFile=\"...\", the single, batch and check modes\n"
+    "compute HMAC-MD5 under that key instead of MD5.\n\n"
+    "Check mode fails if any listed file does not match or cannot be read. As\n"
+    "with md5sum -c, improperly formatted lines are only warned about, unless\n"
+    "--strict=true is given, and a manifest with no valid lines fails.\n\n"
+    "Tree mode splits the file into leaves of leafSize bytes (default 4 MiB),\n"
+    "hashes them in parallel and combines them into a root, written as\n"
+    "md5tree:<leafSize>:<root>; it is not the MD5 hash of the file. --leaves\n"
+    "saves the leaf hashes, and --checkLeaves compares the file against saved\n"
+    "leaf hashes and lists the leaves that changed.\n\n"
+    "Dedupe mode lists the groups of identical files under a directory. Only\n"
+    "files of the same size are read, and only the first and last 64 KiB of each\n"
+    "unless those match too; each group is followed by an empty line.\n\n"
+    "Daemon mode serves hash requests on a socket until it is killed. Each request\n"
+    "and response is a type byte, a 32-bit little-endian length and a payload:\n"
+    "'M' hashes the payload, 'F' hashes the file at the path in the payload, and\n"
+    "'S' returns the server counters. Responses are 'K' with the 16-byte hash or\n"
+    "the counters, or 'E' with an error, in request order. 'F' requests are\n"
+    "refused unless --daemonRoots lists the directories files may be served\n"
+    "from, and then only files under them are hashed. A TCP address with an\n"
+    "empty host listens on 127.0.0.1; use tcp:0.0.0.0:<port> to listen on every\n"
+    "interface.\n";
 
 /*
  * The path to the output file, if provided by the user.
@@ -58,137 +94,1003 @@ static const std::string usage = "\nUsage:\nMD5 --message=\"...\" [--outputFile=
 static std::string out_file;
 
 /*
- * Retrieve the message to be hashed from the command line arguments. The message
- * can be provided as a string or as a file. If the message is provided as a file,
- * the contents of the file are read into a vector of bytes.
+ * The number of bytes read from the message file or standard input at a time,
+ * set with --bufferSize. Only one buffer of input is held in memory, so the
+ * memory used does not depend on the size of the message.
  */
-static std::vector<uint8_t> md5_get_message(int argc, char** argv) {
-    std::vector<std::string> accepted_args = {"message", "messageFile", "outputFile"};
-    std::map<std::string, std::string> args = parse_args(argc, argv, accepted_args, usage);
-    if (args.find("outputFile") != args.end()) {
-        out_file = args["outputFile"];
+static size_t read_buffer_size = 1 << 20;
+
+/*
+ * The number of buffers read ahead on a separate I/O thread, set with
+ * --queueDepth. With 2 or more, reads overlap with hashing; with 0 (the
+ * default), regular files are memory-mapped and other input is read on the
+ * hashing thread. A queue of one buffer could not read ahead, so 1 is refused.
+ */
+static size_t read_queue_depth = 0;
+
+/*
+ * Whether files are read with direct I/O, bypassing the page cache, as set
+ * with --directIO. Files are then never memory-mapped, since mapping reads
+ * through the page cache.
+ */
+static bool read_direct = false;
+
+/*
+ * Thrown by md5_hash_file when it is cancelled before the whole file is hashed.
+ */
+struct Md5Cancelled {};
+
+/*
+ * Pass the contents of an open file to the callback in pieces of
+ * read_buffer_size bytes, starting at the given byte offset: in place if the
+ * file is mapped, and otherwise streamed from the descriptor the MappedFile
+ * already holds, so a pipe is never opened twice.
+ */
+static void md5_read_open_file(const MappedFile& file, uint64_t offset,
+    const std::function<void(const uint8_t*, size_t)>& callback) {
+    if (file.is_mapped()) {
+        for (uint64_t position = offset; position < file.size(); position += read_buffer_size) {
+            callback(file.data() + position,
+                std::min<uint64_t>(read_buffer_size, file.size() - position));
+        }
+    } else {
+        file.read_chunks(read_buffer_size, callback, read_queue_depth, offset);
     }
-    if (args.find("message") == args.end()) {
-        if (args.find("messageFile") == args.end()) {
-            std::cerr << "Error: No message provided." << std::endl;
-            std::cerr << usage << std::endl;
-            exit(1);
+    STATS_ADD(files, 1);
+}
+
+/*
+ * Pass the contents of the file at the given path to the context, starting at
+ * the given byte offset. Unless a read-ahead queue or direct I/O was requested,
+ * the file is opened once as a MappedFile and read with md5_read_open_file.
+ * Otherwise it is read with read_file_chunks. After each chunk, on_chunk is
+ * called if given. If cancelled is given, it is checked between chunks, and
+ * Md5Cancelled is thrown once it becomes true.
+ */
+static void md5_update_from_file(Md5Context& context, const std::string& path,
+    uint64_t offset = 0, const std::atomic<bool>* cancelled = nullptr,
+    const std::function<void()>& on_chunk = nullptr) {
+    auto update = [&](const uint8_t* data, size_t length) {
+        if (cancelled != nullptr && cancelled->load(std::memory_order_relaxed)) {
+            throw Md5Cancelled();
         }
-        return read_file_bytes(args["messageFile"]);
+        context.update(data, length);
+        if (on_chunk) {
+            on_chunk();
+        }
+    };
+    if (read_queue_depth < 2 && !read_direct) {
+        md5_read_open_file(MappedFile(path), offset, update);
+        return;
     }
-    if (args.find("messageFile") != args.end()) {
-        std::cerr << "Error: Both message and messageFile provided." << std::endl;
+    read_file_chunks(path, read_buffer_size, update, read_queue_depth, offset, read_direct);
+    STATS_ADD(files, 1);
+}
+
+/*
+ * The HMAC key given with --key or --keyFile, or nullptr if plain MD5 hashes
+ * are computed.
+ */
+static std::unique_ptr<Md5Hmac> hmac_key;
+
+/*
+ * Return a context for a new message: a plain MD5 context, or one past the
+ * inner padded key if an HMAC key was given.
+ */
+static Md5Context md5_begin() {
+    return hmac_key ? hmac_key->begin() : Md5Context();
+}
+
+/*
+ * Return the hash, or the HMAC if a key was given, of a message streamed
+ * through a context from md5_begin().
+ */
+static Md5Digest md5_finish(Md5Context& context) {
+    return hmac_key ? hmac_key->finish(context) : context.finalize();
+}
+
+/*
+ * Hash the contents of the file at the given path (see md5_update_from_file).
+ */
+static Md5Digest md5_hash_file(const std::string& path,
+    const std::atomic<bool>* cancelled = nullptr) {
+    Md5Context context = md5_begin();
+    md5_update_from_file(context, path, 0, cancelled);
+    return md5_finish(context);
+}
+
+/*
+ * Hash the file at the given path, continuing from the state saved in
+ * state_path if it exists. Every checkpoint_interval bytes, and once the end of
+ * the file is reached, the current state is written back to state_path, so an
+ * interrupted run can be resumed from its last checkpoint, and a file that is
+ * only ever appended to can be hashed again later by reading just the new data.
+ */
+static Md5Digest md5_hash_file_resumable(const std::string& path,
+    const std::string& state_path, uint64_t checkpoint_interval) {
+    Md5Context context;
+    std::error_code error;
+    if (std::filesystem::exists(state_path, error)) {
+        if (!context.import_state(read_file_bytes(state_path))) {
+            throw std::runtime_error("Invalid MD5 state file: " + state_path);
+        }
+        uintmax_t size = std::filesystem::file_size(path, error);
+        if (!error && size < context.length()) {
+            throw std::runtime_error("File is shorter than the saved state: " + path);
+        }
+    }
+    uint64_t last_checkpoint = context.length();
+    md5_update_from_file(context, path, context.length(), nullptr, [&] {
+        if (context.length() - last_checkpoint >= checkpoint_interval) {
+            write_file_atomic(state_path, context.export_state());
+            last_checkpoint = context.length();
+        }
+    });
+    write_file_atomic(state_path, context.export_state());
+    return context.finalize();
+}
+
+/*
+ * The cache of file digests given with --cache, or nullptr if there is none.
+ */
+static std::unique_ptr<DigestCache> digest_cache;
+
+/*
+ * Hash the file at the given path as md5_hash_file does, unless the digest
+ * cache has the digest of a file with the same path, size, modification time
+ * and inode, in which case the file is not read at all. Newly computed digests
+ * are added to the cache.
+ */
+static Md5Digest md5_hash_file_cached(const std::string& path,
+    const std::atomic<bool>* cancelled = nullptr) {
+    FileMetadata metadata;
+    if (digest_cache == nullptr || !read_file_metadata(path, metadata)) {
+        return md5_hash_file(path, cancelled);
+    }
+    Md5Digest digest;
+    if (!digest_cache->lookup(path, metadata, digest.data())) {
+        digest = md5_hash_file(path, cancelled);
+        digest_cache->store(path, metadata, digest.data());
+    }
+    return digest;
+}
+
+/*
+ * Save the digest cache, if there is one, and report how many files were found
+ * in it on stderr.
+ */
+static void md5_save_cache() {
+    if (digest_cache != nullptr) {
+        digest_cache->save();
+        std::cerr << "cache: " << digest_cache->hits() << " hits, "
+            << digest_cache->misses() << " misses" << std::endl;
+    }
+}
+
+/*
+ * Hash many files in parallel with block_hash_files and write one "hash  path"
+ * line per file to the sink, in the same order as the paths. Files that cannot
+ * be read are reported on stderr, and false is returned if there were any.
+ */
+static bool md5_hash_files(const std::vector<std::string>& paths, size_t thread_count,
+    OutputSink& sink) {
+    return block_hash_files(paths, thread_count, sink, [](const std::string& path) {
+        return md5_hash_file_cached(path);
+    });
+}
+
+/*
+ * One line of a checksum manifest: the expected hash and the path of the file.
+ */
+struct Md5ManifestEntry {
+    Md5Digest digest;
+    std::string path;
+};
+
+/*
+ * Parse a checksum manifest in the format written by md5sum and by batch mode:
+ * 32 hex characters, a space, a space or '*' (binary mode), and the path. As in
+ * md5sum, a line starting with a backslash has "\\" and "\n" escapes in its
+ * path. Empty lines are skipped, and the number of lines that could not be
+ * parsed is stored in malformed.
+ */
+static std::vector<Md5ManifestEntry> md5_parse_manifest(const std::string& manifest_path,
+    size_t& malformed) {
+    ByteArena arena;
+    std::vector<Md5ManifestEntry> entries;
+    malformed = 0;
+    for (std::string_view line : block_hash_split_lines(read_file_bytes(manifest_path, arena))) {
+        if (line.empty()) {
+            continue;
+        }
+        bool escaped = line[0] == '\\';
+        size_t offset = escaped ? 1 : 0;
+        Md5ManifestEntry entry;
+        if (line.size() < offset + 35 || line[offset + 32] != ' '
+            || (line[offset + 33] != ' ' && line[offset + 33] != '*')
+            || !hex_decode(line.data() + offset, 32, entry.digest.data())) {
+            ++malformed;
+            continue;
+        }
+        entry.path = std::string(line.substr(offset + 34));
+        if (escaped) {
+            std::string path;
+            for (size_t i = 0; i < entry.path.size(); ++i) {
+                if (entry.path[i] == '\\' && i + 1 < entry.path.size()) {
+                    path += entry.path[++i] == 'n' ? '\n' : entry.path[i];
+                } else {
+                    path += entry.path[i];
+                }
+            }
+            entry.path = path;
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+/*
+ * Verify the files listed in a checksum manifest, hashing them in parallel.
+ * One "path: OK", "path: FAILED" or "path: FAILED open or read" line is written
+ * to the sink per file, in manifest order, followed by warnings and a summary
+ * on stderr. With fail_fast, checking stops at the first file that does not
+ * match or cannot be read: files not yet started are skipped, and files being
+ * hashed are cancelled. Returns true if every file matched. As with md5sum -c,
+ * improperly formatted lines are only warned about unless strict is set, but a
+ * manifest without a single properly formatted line fails.
+ */
+static bool md5_check_manifest(const std::string& manifest_path, size_t thread_count,
+    bool fail_fast, bool strict, OutputSink& sink) {
+    size_t malformed;
+    std::vector<Md5ManifestEntry> entries = md5_parse_manifest(manifest_path, malformed);
+    std::vector<std::string> paths;
+    for (const Md5ManifestEntry& entry : entries) {
+        paths.push_back(entry.path);
+    }
+    OrderedOutput output(sink, entries.size());
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> matched(0), mismatched(0), unreadable(0);
+    {
+        ThreadPool pool(thread_count);
+        for (size_t index : block_hash_largest_first(paths)) {
+            pool.submit([&, index] {
+                const Md5ManifestEntry& entry = entries[index];
+                std::string line;
+                if (!stop) {
+                    try {
+                        Md5Digest digest = md5_hash_file_cached(entry.path,
+                            fail_fast ? &stop : nullptr);
+                        if (digest == entry.digest) {
+                            line = entry.path + ": OK\n";
+                            ++matched;
+                        } else {
+                            line = entry.path + ": FAILED\n";
+                            ++mismatched;
+                            stop = fail_fast;
+                        }
+                    } catch (const Md5Cancelled&) {
+                    } catch (const std::exception& e) {
+                        std::cerr << std::string("Error: ") + e.what() + "\n";
+                        line = entry.path + ": FAILED open or read\n";
+                        ++unreadable;
+                        stop = fail_fast;
+                    }
+                }
+                output.complete(index, std::move(line));
+            });
+        }
+        pool.wait();
+    }
+    output.finish();
+
+    if (entries.empty()) {
+        std::cerr << "Error: " << manifest_path
+            << ": no properly formatted MD5 checksum lines found" << std::endl;
+        return false;
+    }
+    if (malformed > 0) {
+        std::cerr << "WARNING: " << malformed << " line" << (malformed == 1 ? " is" : "s are")
+            << " improperly formatted" << std::endl;
+    }
+    if (unreadable > 0) {
+        std::cerr << "WARNING: " << unreadable << " listed file"
+            << (unreadable == 1 ? "" : "s") << " could not be read" << std::endl;
+    }
+    if (mismatched > 0) {
+        std::cerr << "WARNING: " << mismatched << " computed checksum"
+            << (mismatched == 1 ? " did" : "s did") << " NOT match" << std::endl;
+    }
+    size_t skipped = entries.size() - matched - mismatched - unreadable;
+    std::cerr << "Checked " << matched + mismatched + unreadable << " of " << entries.size()
+        << " files: " << matched << " OK, " << mismatched << " FAILED, " << unreadable
+        << " unreadable" << (skipped > 0 ? ", " + std::to_string(skipped) + " skipped" : "")
+        << std::endl;
+    return matched == entries.size() && (!strict || malformed == 0);
+}
+
+/*
+ * The number of leaves hashed by one task in tree mode, enough to fill every
+ * lane of the widest multi-buffer engine.
+ */
+static constexpr size_t md5_tree_group = 16;
+
+/*
+ * The largest read, in bytes, in tree mode on input that is not memory-mapped.
+ */
+static constexpr size_t md5_tree_read_limit = 256 << 20;
+
+/*
+ * Return the leaf values of the tree hash of the file at the given path, or of
+ * standard input if the path is "-", and set length to the number of bytes
+ * hashed. The input is split into groups of leaves that are hashed in parallel
+ * on thread_count threads, each group through the multi-buffer engine. A
+ * memory-mapped file is hashed in place; other input, including a file that
+ * was opened but could not be mapped, is read from the open descriptor a group
+ * per thread at a time, up to md5_tree_read_limit, and each read is hashed
+ * while the next one is read ahead if a queue was requested.
+ */
+static std::vector<Md5Digest> md5_tree_leaf_digests(const std::string& path, size_t leaf_size,
+    size_t thread_count, uint64_t& length) {
+    std::vector<Md5Digest> digests;
+    ThreadPool pool(thread_count);
+    auto hash_groups = [&](const uint8_t* data, size_t size) {
+        size_t first = digests.size();
+        digests.resize(first + (size - 1) / leaf_size + 1);
+        for (size_t offset = 0; offset < size; offset += leaf_size * md5_tree_group) {
+            pool.submit([&, data, size, offset] {
+                size_t group_length = std::min(size - offset, leaf_size * md5_tree_group);
+                md5_tree_leaves(data + offset, group_length, leaf_size,
+                    digests.data() + first + offset / leaf_size);
+            });
+        }
+        pool.wait();
+        length += size;
+    };
+    length = 0;
+    size_t workers = thread_count == 0
+        ? std::max(1u, std::thread::hardware_concurrency()) : thread_count;
+    size_t group_size = leaf_size * md5_tree_group;
+    size_t read_size = group_size * std::max<size_t>(1,
+        std::min(workers, md5_tree_read_limit / group_size));
+    if (path == "-") {
+        read_stdin_chunks(read_size, hash_groups, read_queue_depth);
+    } else if (read_queue_depth < 2 && !read_direct) {
+        MappedFile file(path);
+        if (!file.is_mapped()) {
+            file.read_chunks(read_size, hash_groups, read_queue_depth);
+        } else if (file.size() != 0) {
+            hash_groups(file.data(), file.size());
+        }
+        STATS_ADD(files, 1);
+    } else {
+        read_file_chunks(path, read_size, hash_groups, read_queue_depth, 0, read_direct);
+        STATS_ADD(files, 1);
+    }
+    if (digests.empty()) {
+        digests.resize(1);
+        md5_tree_leaves(nullptr, 0, leaf_size, digests.data());
+    }
+    return digests;
+}
+
+/*
+ * Return the labeled form of a tree hash, "md5tree:<leaf size>:<root>", which
+ * cannot be mistaken for a plain MD5 hash.
+ */
+static std::string md5_tree_label(size_t leaf_size, const std::vector<Md5Digest>& leaf_digests) {
+    Md5Digest root = md5_tree_root(leaf_digests.data(), leaf_digests.size());
+    return "md5tree:" + std::to_string(leaf_size) + ":" + root.hex();
+}
+
+/*
+ * Compare the leaf values of a file with those saved by --leaves in
+ * leaves_path, and write a line to the sink for every leaf that changed,
+ * was added or was removed, with the range of bytes it covers in a file of
+ * length bytes. Returns true if no leaf changed.
+ */
+static bool md5_tree_check_leaves(const std::string& leaves_path, size_t leaf_size,
+    const std::vector<Md5Digest>& leaf_digests, uint64_t length, OutputSink& sink) {
+    ByteArena arena;
+    std::vector<std::string_view> lines =
+        block_hash_split_lines(read_file_bytes(leaves_path, arena));
+    std::string prefix = "md5tree:" + std::to_string(leaf_size) + ":";
+    if (lines.empty() || lines[0].compare(0, prefix.size(), prefix) != 0) {
+        throw std::runtime_error("Not a leaf file for leaves of " + std::to_string(leaf_size)
+            + " bytes: " + leaves_path);
+    }
+    size_t saved = lines.size() - 1, current = leaf_digests.size();
+    bool unchanged = true;
+    for (size_t i = 0; i < std::max(saved, current); ++i) {
+        Md5Digest digest;
+        const char* status = nullptr;
+        if (i >= saved) {
+            status = "added";
+        } else if (i >= current) {
+            status = "removed";
+        } else if (!Md5Digest::from_hex(lines[i + 1], digest)) {
+            throw std::runtime_error("Invalid leaf hash on line " + std::to_string(i + 2)
+                + " of " + leaves_path);
+        } else if (digest != leaf_digests[i]) {
+            status = "changed";
+        }
+        if (status != nullptr) {
+            uint64_t first_byte = (uint64_t) i * leaf_size;
+            uint64_t end_byte = first_byte + leaf_size;
+            if (i < current) {
+                end_byte = std::min(end_byte, length);
+            }
+            std::string range = end_byte == first_byte ? "no bytes" : "bytes "
+                + std::to_string(first_byte) + "-" + std::to_string(end_byte - 1);
+            sink.write("leaf " + std::to_string(i) + " (" + range + "): " + status + "\n");
+            unchanged = false;
+        }
+    }
+    return unchanged;
+}
+
+/*
+ * Run tree mode: hash the file given with --messageFile as a tree, save or
+ * check its leaves if asked to, and write the labeled root. Returns the exit
+ * status.
+ */
+static int md5_tree_mode(std::map<std::string, std::string>& args) {
+    if (args.find("messageFile") == args.end() || args.find("message") != args.end()) {
+        std::cerr << "Error: Tree mode needs a messageFile." << std::endl;
         std::cerr << usage << std::endl;
         exit(1);
     }
-    return std::vector<uint8_t>(args["message"].begin(), args["message"].end());
+    size_t leaf_size = 4 << 20;
+    if (args.find("leafSize") != args.end()) {
+        leaf_size = std::stoul(args["leafSize"]);
+        if (leaf_size == 0) {
+            std::cerr << "Error: leafSize must be positive." << std::endl;
+            exit(1);
+        }
+    }
+    size_t thread_count = 0;
+    if (args.find("threads") != args.end()) {
+        thread_count = std::stoul(args["threads"]);
+    }
+    uint64_t length = 0;
+    std::vector<Md5Digest> leaf_digests = md5_tree_leaf_digests(args["messageFile"],
+        leaf_size, thread_count, length);
+    std::string label = md5_tree_label(leaf_size, leaf_digests);
+    OutputSink sink(out_file);
+    bool unchanged = true;
+    if (args.find("checkLeaves") != args.end()) {
+        unchanged = md5_tree_check_leaves(args["checkLeaves"], leaf_size, leaf_digests, length,
+            sink);
+    }
+    if (args.find("leaves") != args.end()) {
+        std::string text = label + "\n";
+        for (const Md5Digest& digest : leaf_digests) {
+            text.append(32, '\0');
+            digest.to_hex(&text[text.size() - 32]);
+            text += '\n';
+        }
+        write_file_atomic(args["leaves"], text);
+    }
+    sink.write((out_file.empty() ? "hash: " : "") + label + "\n");
+    return unchanged ? 0 : 1;
 }
 
-/* 
- * Given a message, pad it to a multiple of 64 bytes (512 bits) as per the MD5
- * specification. The padding consists of a 1 bit, followed by 0 bits until
- * there are 8 bytes remaining (until the message is padded to a multiple of 64
- * bytes). Finally, the original message length is appended as a 64-bit integer
- * in little-endian format.
+/*
+ * The number of bytes read from each end of a file in dedupe mode to tell apart
+ * files of the same size before reading them in full.
+ */
+static constexpr size_t md5_dedupe_probe = 64 << 10;
+
+/*
+ * A file found in dedupe mode: its size, and the hash of its ends or, once it
+ * has been read in full, of all of it.
+ */
+struct Md5DedupeFile {
+    std::string path;
+    uint64_t size;
+    Md5Digest digest;
+    bool complete;
+    bool failed;
+};
+
+/*
+ * Hash the first and last md5_dedupe_probe bytes of the file, given its size.
+ * A file no larger than the two ends together is read whole, so the result is
+ * its MD5 hash and the file is marked complete. The buffer comes from the
+ * buffer pool rather than the stack, which may be small on a pool worker.
  */
-static void md5_pad_message(std::vector<uint8_t>& message) {
-    uint64_t originalLength = message.size() * 8;
-    message.push_back(0x80);
-    while ((message.size() + 8) % 64 != 0) {
-        message.push_back(0);
+static void md5_dedupe_probe_file(Md5DedupeFile& file) {
+    PooledBuffer probe(2 * md5_dedupe_probe);
+    uint8_t* buffer = probe.data();
+    size_t expected = std::min<uint64_t>(file.size, probe.size());
+    size_t length = 0;
+    if (file.size <= probe.size()) {
+        length = file.size == 0 ? 0 : read_file_range(file.path, 0, buffer, expected);
+    } else {
+        length = read_file_range(file.path, 0, buffer, md5_dedupe_probe);
+        length += read_file_range(file.path, file.size - md5_dedupe_probe,
+            buffer + md5_dedupe_probe, md5_dedupe_probe);
     }
-    for (int i = 0; i < 8; ++i) {
-        message.push_back((originalLength >> (i * 8)) & 0xff);
+    if (length != expected) {
+        throw std::runtime_error("File changed while it was read: " + file.path);
     }
+    file.digest = md5_hash(buffer, length);
+    file.complete = file.size <= probe.size();
 }
 
 /*
- * Given a message and an index i, return the i-th 512-bit chunk of the message as a
- * vector of 16 32-bit integers.
+ * Sort the given files by size and hash and return every run of two or more
+ * with the same size and hash. Files that could not be read are left out.
  */
-static std::vector<uint32_t> md5_get_chunk(const std::vector<uint8_t>& message, int i) {
-    assert(i >= 0 && i < (int) message.size());
-    std::vector<uint32_t> chunk(16);
-    for (int j = 0; j < 16; ++j) {
-        for (int k = 0; k < 4; ++k) {
-            chunk[j] |= message[i + j * 4 + k] << (8 * k);
+static std::vector<std::vector<size_t>> md5_dedupe_groups(
+    const std::vector<Md5DedupeFile>& files, std::vector<size_t> indices) {
+    indices.erase(std::remove_if(indices.begin(), indices.end(), [&](size_t i) {
+        return files[i].failed;
+    }), indices.end());
+    std::sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
+        if (files[a].size != files[b].size) {
+            return files[a].size > files[b].size;
+        }
+        if (files[a].digest != files[b].digest) {
+            return files[a].digest < files[b].digest;
+        }
+        return files[a].path < files[b].path;
+    });
+    std::vector<std::vector<size_t>> groups;
+    for (size_t start = 0, end; start < indices.size(); start = end) {
+        end = start + 1;
+        while (end < indices.size() && files[indices[end]].size == files[indices[start]].size
+            && files[indices[end]].digest == files[indices[start]].digest) {
+            ++end;
+        }
+        if (end - start >= 2) {
+            groups.emplace_back(indices.begin() + start, indices.begin() + end);
         }
     }
-    return chunk;
+    return groups;
 }
 
-/* 
- * Rotate a 32-bit integer left by n bits.
+/*
+ * Run step on each of the given files in parallel, largest first. A file that
+ * cannot be read is reported on stderr and marked as failed.
  */
-static uint32_t md5_rotate(uint32_t x, int n) {
-    return (x << n) | (x >> (32 - n));
+static void md5_dedupe_each(std::vector<Md5DedupeFile>& files, std::vector<size_t> indices,
+    size_t thread_count, void (*step)(Md5DedupeFile&)) {
+    std::stable_sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
+        return files[a].size > files[b].size;
+    });
+    ThreadPool pool(thread_count);
+    for (size_t index : indices) {
+        pool.submit([&files, index, step] {
+            try {
+                step(files[index]);
+            } catch (const std::exception& e) {
+                std::cerr << std::string("Error: ") + e.what() + "\n";
+                files[index].failed = true;
+            }
+        });
+    }
+    pool.wait();
 }
 
 /*
- * Process a 512-bit chunk of the message using the MD5 algorithm. The chunk is
- * processed in 16 rounds, with each round updating the state of the hash function.
+ * Find the duplicate files under a directory and write them to the sink as
+ * groups of "hash  path" lines, one group per set of identical files, with an
+ * empty line after each group. Reading is narrowed down in three passes: only
+ * files that share their size with another file are read at all; of those,
+ * the first and last md5_dedupe_probe bytes are hashed; and only the files
+ * whose ends also match are hashed in full. Both hashing passes run on
+ * thread_count threads. Groups are written from the largest files down.
+ * Returns false if any file could not be read.
  */
-static std::vector<uint32_t> md5_process_chunk(const std::vector<uint32_t>& chunk,
-    uint32_t A, uint32_t B, uint32_t C, uint32_t D) {
-    for (int i = 0; i < 64; ++i) {
-        uint32_t input_word, fghi;
-        if (i < 16) {
-            input_word = chunk[i];
-            fghi = (B & C) | ((~B) & D);
-        } else if (i < 32) {
-            input_word = chunk[(5 * i + 1) % 16];
-            fghi = (D & B) | ((~D) & C);
-        } else if (i < 48) {
-            input_word = chunk[(3 * i + 5) % 16];
-            fghi = B ^ C ^ D;
-        } else {
-            input_word = chunk[(7 * i) % 16];
-            fghi = C ^ (B | (~D));
+static bool md5_dedupe(const std::string& directory, size_t thread_count, OutputSink& sink) {
+    std::vector<Md5DedupeFile> files;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+        std::error_code error;
+        if (entry.is_regular_file(error)) {
+            uintmax_t size = entry.file_size(error);
+            if (!error) {
+                files.push_back({entry.path().string(), size, Md5Digest{}, false, false});
+            }
         }
-        uint32_t temp = D;
-        D = C;
-        C = B;
-        B = md5_rotate(fghi + A + input_word + K[i], S[i]) + B;
-        A = temp;
     }
-    return {A, B, C, D};
+    std::vector<size_t> by_size(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        by_size[i] = i;
+    }
+    std::sort(by_size.begin(), by_size.end(), [&](size_t a, size_t b) {
+        return files[a].size < files[b].size;
+    });
+    std::vector<size_t> same_size;
+    for (size_t i = 0; i < by_size.size(); ++i) {
+        uint64_t size = files[by_size[i]].size;
+        if ((i > 0 && files[by_size[i - 1]].size == size)
+            || (i + 1 < by_size.size() && files[by_size[i + 1]].size == size)) {
+            same_size.push_back(by_size[i]);
+        }
+    }
+    md5_dedupe_each(files, same_size, thread_count, md5_dedupe_probe_file);
+
+    std::vector<size_t> partial;
+    for (const std::vector<size_t>& group : md5_dedupe_groups(files, same_size)) {
+        if (!files[group[0]].complete) {
+            partial.insert(partial.end(), group.begin(), group.end());
+        }
+    }
+    md5_dedupe_each(files, partial, thread_count, [](Md5DedupeFile& file) {
+        file.digest = md5_hash_file_cached(file.path);
+        file.complete = true;
+    });
+
+    size_t duplicates = 0;
+    uint64_t wasted = 0;
+    bool failed = false;
+    std::vector<std::vector<size_t>> groups = md5_dedupe_groups(files, same_size);
+    for (const std::vector<size_t>& group : groups) {
+        for (size_t index : group) {
+            std::string line(32, '\0');
+            files[index].digest.to_hex(line.data());
+            sink.write(line + "  " + files[index].path + "\n");
+        }
+        sink.write("\n");
+        duplicates += group.size() - 1;
+        wasted += files[group[0]].size * (group.size() - 1);
+    }
+    for (size_t index : same_size) {
+        failed = failed || files[index].failed;
+    }
+    sink.flush();
+    std::cerr << "dedupe: " << files.size() << " files, " << same_size.size()
+        << " with the same size as another, " << partial.size() << " hashed in full; "
+        << groups.size() << " groups, " << duplicates << " duplicates, " << wasted
+        << " bytes in duplicates" << std::endl;
+    return !failed;
+}
+
+/*
+ * Measure the throughput of every supported engine and of each way of reading
+ * a file, and return the results as a JSON document. Each engine is measured
+ * hashing a single message (the block function used by Md5Context, with the
+ * padding done on the stack) and hashing a batch of independent messages of the
+ * same size through its multi-buffer function. The "quick" profile covers
+ * messages from 0 bytes to 16 MiB; the "full" profile goes up to 1 GiB. Then
+ * md5_batch is measured on keys of 32 to 200 bytes, and hex encoding and
+ * decoding of a digest. The I/O
+ * paths are measured hashing a temporary file through read_file_bytes, the
+ * memory mapping, chunked reads and the read-ahead queue.
+ */
+static std::string md5_benchmark(const std::string& profile) {
+    if (profile != "quick" && profile != "full") {
+        std::cerr << "Error: Unknown benchmark profile: " << profile << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+    bool full = profile == "full";
+    double min_seconds = full ? 1.0 : 0.2;
+    std::vector<size_t> sizes = {0, 64, 1 << 10, 1 << 16, 1 << 20, 1 << 24};
+    if (full) {
+        sizes.push_back(1 << 28);
+        sizes.push_back(1 << 30);
+    }
+    std::mt19937 rng(12345);
+    std::vector<uint8_t> data = block_hash_benchmark_data(sizes.back(), rng);
+
+    std::vector<std::string> results;
+    const Md5Engine* selected_engine = md5_current_engine();
+    for (size_t e = 0; e < md5_engine_count(); ++e) {
+        const Md5Engine& engine = md5_engine_at(e);
+        if (!engine.supported()) {
+            continue;
+        }
+        md5_use_engine(&engine);
+        std::string name = std::string("\"engine\": \"") + engine.name + "\"";
+        for (size_t size : sizes) {
+            uint8_t digest[16];
+            BlockHashBenchmarkResult single = block_hash_benchmark_run(size, min_seconds, [&] {
+                Md5Context context;
+                context.update(data.data(), size);
+                context.finalize(digest);
+            });
+            results.push_back(block_hash_benchmark_json("\"benchmark\": \"single\", " + name,
+                single));
+            if (size > (1 << 24)) {
+                continue;
+            }
+            size_t count = std::clamp<size_t>((1 << 26) / std::max<size_t>(size, 64), 16, 4096);
+            std::vector<const uint8_t*> messages(count, data.data());
+            std::vector<size_t> lengths(count, size);
+            std::vector<uint8_t> digests(count * 16);
+            BlockHashBenchmarkResult multi = block_hash_benchmark_run(size * count,
+                min_seconds, [&] {
+                    engine.hash_many(messages.data(), lengths.data(), count, md5_initial_state,
+                        0, digests.data());
+                });
+            multi.iterations *= count;
+            results.push_back(block_hash_benchmark_json("\"benchmark\": \"multi\", " + name,
+                multi));
+        }
+    }
+    md5_use_engine(selected_engine);
+
+    std::vector<const uint8_t*> keys(1 << 16);
+    std::vector<size_t> key_lengths(keys.size());
+    std::vector<Md5Digest> key_digests(keys.size());
+    uint64_t key_bytes = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        key_lengths[i] = 32 + rng() % 169;
+        keys[i] = data.data() + (i * 64) % (data.size() - 256);
+        key_bytes += key_lengths[i];
+    }
+    BlockHashBenchmarkResult batch = block_hash_benchmark_run(key_bytes, min_seconds, [&] {
+        md5_batch(keys.data(), key_lengths.data(), keys.size(), key_digests.data());
+    });
+    batch.iterations *= keys.size();
+    results.push_back(block_hash_benchmark_json("\"benchmark\": \"batch_keys\", \"engine\": \""
+        + std::string(md5_current_engine()->name) + "\"", batch));
+
+    Md5Hmac hmac(data.data(), 16);
+    std::vector<const uint8_t*> packets(1 << 12);
+    std::vector<size_t> packet_lengths(packets.size(), 64);
+    std::vector<uint8_t> macs(packets.size() * 16);
+    for (size_t i = 0; i < packets.size(); ++i) {
+        packets[i] = data.data() + i * 64;
+    }
+    BlockHashBenchmarkResult hmac_single = block_hash_benchmark_run(64, min_seconds, [&] {
+        hmac.mac(packets[0], 64, macs.data());
+    });
+    results.push_back(block_hash_benchmark_json("\"benchmark\": \"hmac_64\", \"engine\": \""
+        + std::string(md5_current_engine()->name) + "\"", hmac_single));
+    BlockHashBenchmarkResult hmac_batch = block_hash_benchmark_run(64 * packets.size(),
+        min_seconds, [&] {
+            hmac.mac_batch(packets.data(), packet_lengths.data(), packets.size(), macs.data());
+        });
+    hmac_batch.iterations *= packets.size();
+    results.push_back(block_hash_benchmark_json("\"benchmark\": \"hmac_batch_64\", \"engine\": \""
+        + std::string(md5_current_engine()->name) + "\"", hmac_batch));
+
+    uint8_t digest[16];
+    char hex[32];
+    std::copy(data.begin(), data.begin() + 16, digest);
+    BlockHashBenchmarkResult encode = block_hash_benchmark_run(16, min_seconds, [&] {
+        hex_encode(digest, 16, hex);
+        asm volatile("" : : "r"(hex) : "memory");
+    });
+    results.push_back(block_hash_benchmark_json("\"benchmark\": \"hex_encode\"", encode));
+    BlockHashBenchmarkResult decode = block_hash_benchmark_run(16, min_seconds, [&] {
+        hex_decode(hex, 32, digest);
+        asm volatile("" : : "r"(digest) : "memory");
+    });
+    results.push_back(block_hash_benchmark_json("\"benchmark\": \"hex_decode\"", decode));
+
+    block_hash_benchmark_io<Md5Context>(data, full ? (1 << 28) : (1 << 24), min_seconds,
+        "md5_benchmark.bin", read_buffer_size, read_queue_depth, md5_current_engine()->name,
+        results);
+    return block_hash_benchmark_document(profile, md5_current_engine()->name, results);
+}
+
+/*
+ * Retrieve the message to be hashed from the command line arguments and return
+ * its hash. The message can be provided as a string or as a file. A message
+ * file of "-" means the message is read from standard input.
+ */
+static Md5Digest md5_hash_message(std::map<std::string, std::string>& args) {
+    Md5Context context = md5_begin();
+    if (args.find("message") == args.end()) {
+        if (args.find("messageFile") == args.end()) {
+            std::cerr << "Error: No message provided." << std::endl;
+            std::cerr << usage << std::endl;
+            exit(1);
+        }
+        if (args["messageFile"] == "-") {
+            if (args.find("resume") != args.end()) {
+                std::cerr << "Error: resume cannot be used with standard input." << std::endl;
+                std::cerr << usage << std::endl;
+                exit(1);
+            }
+            read_stdin_chunks(read_buffer_size, [&context](const uint8_t* data, size_t length) {
+                context.update(data, length);
+            }, read_queue_depth);
+            return md5_finish(context);
+        }
+        if (args.find("resume") != args.end()) {
+            uint64_t checkpoint_interval = 1ull << 30;
+            if (args.find("checkpointInterval") != args.end()) {
+                checkpoint_interval = std::stoull(args["checkpointInterval"]);
+            }
+            return md5_hash_file_resumable(args["messageFile"], args["resume"],
+                checkpoint_interval);
+        }
+        return md5_hash_file(args["messageFile"]);
+    }
+    if (args.find("messageFile") != args.end()) {
+        std::cerr << "Error: Both message and messageFile provided." << std::endl;
+        std::cerr << usage << std::endl;
+        exit(1);
+    }
+    context.update(args["message"]);
+    return md5_finish(context);
 }
 
 
 int main(int argc, char** argv) {
-    std::vector<uint8_t> message = md5_get_message(argc, argv);
-    md5_pad_message(message);
-
-    // Initial MD5 state is a hard-coded constant split into four 32-bit words.
-    uint32_t A = 0x67452301;
-    uint32_t B = 0xefcdab89;
-    uint32_t C = 0x98badcfe;
-    uint32_t D = 0x10325476;
-
-    // Process each 512-bit chunk of the message in sequence
-    for (int i = 0; i < (int) message.size(); i += 64) {
-        std::vector<uint32_t> chunk = md5_get_chunk(message, i);
-        std::vector<uint32_t> result = md5_process_chunk(chunk, A, B, C, D);
-        A += result[0];
-        B += result[1];
-        C += result[2];
-        D += result[3];
-    }
-
-    // Convert the final state to bytes to ensure correct endianness
-    std::vector<uint8_t> result_bytes(16);
-    for (int i = 0; i < 4; ++i) {
-        result_bytes[i] = (A >> (i * 8)) & 0xff;
-        result_bytes[i + 4] = (B >> (i * 8)) & 0xff;
-        result_bytes[i + 8] = (C >> (i * 8)) & 0xff;
-        result_bytes[i + 12] = (D >> (i * 8)) & 0xff;
+    std::vector<std::string> accepted_args = {"message", "messageFile", "outputFile",
+        "selfTest", "engine", "directory", "fileList", "threads", "bufferSize",
+        "queueDepth", "benchmark", "check", "failFast", "strict", "cache",
+        "resume", "checkpointInterval", "stats", "tree", "leafSize", "leaves",
+        "checkLeaves", "key", "keyFile", "dedupe", "daemon", "daemonRoots", "directIO"};
+    std::map<std::string, std::string> args = parse_args(argc, argv, accepted_args, usage);
+    if (args.find("outputFile") != args.end()) {
+        out_file = args["outputFile"];
+    }
+    if (args.find("bufferSize") != args.end()) {
+        read_buffer_size = std::stoul(args["bufferSize"]);
+        if (read_buffer_size == 0) {
+            std::cerr << "Error: bufferSize must be positive." << std::endl;
+            exit(1);
+        }
+    }
+    if (args.find("queueDepth") != args.end()) {
+        read_queue_depth = std::stoul(args["queueDepth"]);
+        if (read_queue_depth == 1) {
+            std::cerr << "Error: queueDepth must be 0 or at least 2." << std::endl;
+            std::cerr << usage << std::endl;
+            exit(1);
+        }
+    }
+    read_direct = args.find("directIO") != args.end() && args["directIO"] != "0"
+        && args["directIO"] != "false";
+    if (args.find("engine") != args.end()) {
+        const Md5Engine* engine = md5_find_engine(args["engine"]);
+        if (engine == nullptr) {
+            std::cerr << "Error: Unsupported engine: " << args["engine"] << std::endl;
+            std::cerr << "Supported engines:";
+            for (size_t e = 0; e < md5_engine_count(); ++e) {
+                if (md5_engine_at(e).supported()) {
+                    std::cerr << " " << md5_engine_at(e).name;
+                }
+            }
+            std::cerr << std::endl;
+            exit(1);
+        }
+        md5_use_engine(engine);
+    }
+    if (args.find("selfTest") != args.end()) {
+        int iterations = std::stoi(args["selfTest"]);
+        bool passed = md5_self_test(iterations);
+        std::cout << "self test: " << (passed ? "passed" : "FAILED") << std::endl;
+        return passed ? 0 : 1;
+    }
+
+    if (args.find("benchmark") != args.end()) {
+        std::string json = md5_benchmark(args["benchmark"]);
+        if (out_file.empty()) {
+            std::cout << json << std::flush;
+        } else {
+            write_file(out_file, json);
+        }
+        return 0;
     }
 
+    if (args.find("stats") != args.end() && args["stats"] != "0" && args["stats"] != "false") {
+#if HASH_STATS
+        stats_enable();
+#else
+        std::cerr << "Error: This build was compiled without stats (HASH_STATS=0)." << std::endl;
+        exit(1);
+#endif
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    if (args.find("key") != args.end() || args.find("keyFile") != args.end()) {
+        if (args.find("key") != args.end() && args.find("keyFile") != args.end()) {
+            std::cerr << "Error: Both key and keyFile provided." << std::endl;
+            std::cerr << usage << std::endl;
+            exit(1);
+        }
+        for (const char* name : {"cache", "resume", "tree", "dedupe"}) {
+            if (args.find(name) != args.end()) {
+                std::cerr << "Error: " << name << " cannot be used with an HMAC key."
+                    << std::endl;
+                std::cerr << usage << std::endl;
+                exit(1);
+            }
+        }
+        std::vector<uint8_t> key;
+        if (args.find("key") != args.end()) {
+            key.assign(args["key"].begin(), args["key"].end());
+        } else {
+            key = read_file_bytes(args["keyFile"]);
+        }
+        hmac_key = std::make_unique<Md5Hmac>(key.data(), key.size());
+    }
+
+    if (args.find("cache") != args.end()) {
+        digest_cache = std::make_unique<DigestCache>(args["cache"]);
+    }
+    if (args.find("check") != args.end()) {
+        size_t thread_count = 0;
+        if (args.find("threads") != args.end()) {
+            thread_count = std::stoul(args["threads"]);
+        }
+        bool fail_fast = args.find("failFast") != args.end()
+            && args["failFast"] != "0" && args["failFast"] != "false";
+        OutputSink sink(out_file);
+        bool strict = args.find("strict") != args.end()
+            && args["strict"] != "0" && args["strict"] != "false";
+        bool passed = md5_check_manifest(args["check"], thread_count, fail_fast, strict, sink);
+        md5_save_cache();
+        block_hash_report_stats(start);
+        return passed ? 0 : 1;
+    }
+
+    if (args.find("daemon") != args.end()) {
+        size_t thread_count = 0;
+        if (args.find("threads") != args.end()) {
+            thread_count = std::stoul(args["threads"]);
+        }
+        std::vector<std::string> roots;
+        if (args.find("daemonRoots") != args.end()) {
+            std::string list = args["daemonRoots"];
+            for (size_t begin = 0, end; begin <= list.size(); begin = end + 1) {
+                end = std::min(list.find(':', begin), list.size());
+                if (end > begin) {
+                    roots.push_back(list.substr(begin, end - begin));
+                }
+            }
+        }
+        return md5_serve(args["daemon"], thread_count, hmac_key.get(),
+            [](const MappedFile& file) {
+                Md5Context context = md5_begin();
+                md5_read_open_file(file, 0, [&context](const uint8_t* data, size_t length) {
+                    context.update(data, length);
+                });
+                return md5_finish(context);
+            }, roots);
+    }
+
+    if (args.find("dedupe") != args.end()) {
+        size_t thread_count = 0;
+        if (args.find("threads") != args.end()) {
+            thread_count = std::stoul(args["threads"]);
+        }
+        OutputSink sink(out_file);
+        bool passed = md5_dedupe(args["dedupe"], thread_count, sink);
+        md5_save_cache();
+        block_hash_report_stats(start);
+        return passed ? 0 : 1;
+    }
+
+    if (args.find("directory") != args.end() || args.find("fileList") != args.end()) {
+        if (args.find("directory") != args.end() && args.find("fileList") != args.end()) {
+            std::cerr << "Error: Both directory and fileList provided." << std::endl;
+            std::cerr << usage << std::endl;
+            exit(1);
+        }
+        size_t thread_count = 0;
+        if (args.find("threads") != args.end()) {
+            thread_count = std::stoul(args["threads"]);
+        }
+        OutputSink sink(out_file);
+        bool passed = md5_hash_files(block_hash_batch_paths(args), thread_count, sink);
+        md5_save_cache();
+        block_hash_report_stats(start);
+        return passed ? 0 : 1;
+    }
+
+    if (args.find("tree") != args.end() && args["tree"] != "0" && args["tree"] != "false") {
+        int status = md5_tree_mode(args);
+        block_hash_report_stats(start);
+        return status;
+    }
+
+    Md5Digest result = md5_hash_message(args);
+
     if (out_file.empty()) {
-        std::cout << "hash: " << to_hex_string(result_bytes) << std::endl;
+        std::cout << (hmac_key ? "hmac: " : "hash: ") << result.hex()
+            << std::endl;
     } else {
         std::cout << "Writing hash to " << out_file << "...";
-        write_file(out_file, to_hex_string(result_bytes));
+        write_file(out_file, result.hex());
         std::cout << " Done." << std::endl;
     }
+    block_hash_report_stats(start);
 }
@@ -0,0 +1,1249 @@
+/* 
+ * libmd5.cpp
+ *
+ * The MD5 library: the block kernels, the multi-buffer engines and the choice
+ * between them, and the one-shot, streaming and batch interfaces declared in
+ * libmd5.h. The command line program in MD5.cpp is a thin wrapper around it.
+ * 
+ */
+
+#include "libmd5.h"
+#include "../block_hash_check.h"
+#include "../buffer_pool.h"
+#include "../io.h"
+#include "../stats.h"
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <random>
+#include <cstdlib>
+#include <new>
+
+/*
+ * The tables of constants and shift amounts are shared with the compile-time
+ * md5() in md5_constexpr.h.
+ */
+using md5_detail::K;
+using md5_detail::S;
+
+/*
+ * Return true if digest is the hash written in hexadecimal as expected. This is
+ * a constant expression, so the compile-time md5() can be checked below.
+ */
+static constexpr bool md5_digest_equals(const std::array<uint8_t, 16>& digest,
+    const char* expected) {
+    constexpr char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < 16; ++i) {
+        if (expected[2 * i] != hex[digest[i] >> 4] || expected[2 * i + 1] != hex[digest[i] & 15]) {
+            return false;
+        }
+    }
+    return expected[32] == '\0';
+}
+
+/*
+ * The test suite of RFC 1321, evaluated by the compiler.
+ */
+static_assert(md5_digest_equals(md5(""), "d41d8cd98f00b204e9800998ecf8427e"));
+static_assert(md5_digest_equals(md5("a"), "0cc175b9c0f1b6a831c399e269772661"));
+static_assert(md5_digest_equals(md5("abc"), "900150983cd24fb0d6963f7d28e17f72"));
+static_assert(md5_digest_equals(md5("message digest"), "f96b697d7cb7938d525a2f31aaf161d0"));
+static_assert(md5_digest_equals(md5("abcdefghijklmnopqrstuvwxyz"),
+    "c3fcd3d76192e4007dfb496cca67e13b"));
+static_assert(md5_digest_equals(
+    md5("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"),
+    "d174ab98d277d9f5a5611c2c9f419d9f"));
+static_assert(md5_digest_equals(
+    md5("12345678901234567890123456789012345678901234567890123456789012345678901234567890"),
+    "57edf4a22be3c955ac49da2e2107b67a"));
+
+/*
+ * Given a 64-byte (512-bit) block of the message, load the block into 16 32-bit
+ * integers. The bytes of each integer are stored in little-endian order.
+ */
+static void md5_get_chunk(const uint8_t* block, uint32_t chunk[16]) {
+    for (int j = 0; j < 16; ++j) {
+        chunk[j] = (uint32_t) block[j * 4]
+            | ((uint32_t) block[j * 4 + 1] << 8)
+            | ((uint32_t) block[j * 4 + 2] << 16)
+            | ((uint32_t) block[j * 4 + 3] << 24);
+    }
+}
+
+/*
+ * Process a 512-bit block of the message using the MD5 algorithm, with the
+ * reference block function shared with the compile-time md5(). The block is
+ * loaded into an array on the stack, so no memory is allocated.
+ */
+static void md5_process_chunk(uint32_t state[4], const uint8_t* block) {
+    uint32_t chunk[16];
+    md5_get_chunk(block, chunk);
+    md5_detail::process_chunk(state, chunk);
+}
+
+/*
+ * Return the index of the message word used in round i of the MD5 algorithm.
+ */
+static constexpr int md5_word_index(int i) {
+    return i < 16 ? i : i < 32 ? (5 * i + 1) % 16 : i < 48 ? (3 * i + 5) % 16 : (7 * i) % 16;
+}
+
+/*
+ * Perform round i of the MD5 algorithm. The round number is a template argument,
+ * so the round function, the message word, the constant and the shift amount
+ * are all chosen at compile time. Instead of moving the four state words around
+ * after every round, the role of each word in v rotates with the round number.
+ * Word is either uint32_t or a vector of 32-bit lanes, one lane per message.
+ */
+template <int i, typename Word>
+static inline __attribute__((always_inline)) void md5_round(Word v[4],
+    const Word chunk[16]) {
+    Word& a = v[(64 - i) % 4];
+    Word b = v[(65 - i) % 4];
+    Word c = v[(66 - i) % 4];
+    Word d = v[(67 - i) % 4];
+    Word fghi;
+    if constexpr (i < 16) {
+        fghi = d ^ (b & (c ^ d));
+    } else if constexpr (i < 32) {
+        fghi = c ^ (d & (b ^ c));
+    } else if constexpr (i < 48) {
+        fghi = b ^ c ^ d;
+    } else {
+        fghi = c ^ (b | (~d));
+    }
+    Word sum = a + fghi + chunk[md5_word_index(i)] + K[i];
+    a = ((sum << S[i]) | (sum >> (32 - S[i]))) + b;
+}
+
+/*
+ * Expand to all 64 rounds of the MD5 algorithm as straight-line code.
+ */
+template <typename Word, int... i>
+static inline __attribute__((always_inline)) void md5_rounds(Word v[4],
+    const Word chunk[16], std::integer_sequence<int, i...>) {
+    (md5_round<i>(v, chunk), ...);
+}
+
+/*
+ * Process a 512-bit block of the message using the MD5 algorithm. This produces
+ * the same result as md5_process_chunk, but the 64 rounds are unrolled at compile
+ * time, so there are no branches and every index and shift amount is a constant.
+ */
+static void md5_process_chunk_unrolled(uint32_t state[4], const uint8_t* block) {
+    uint32_t chunk[16];
+    md5_get_chunk(block, chunk);
+    uint32_t v[4] = {state[0], state[1], state[2], state[3]};
+    md5_rounds(v, chunk, std::make_integer_sequence<int, 64>());
+    state[0] += v[0];
+    state[1] += v[1];
+    state[2] += v[2];
+    state[3] += v[3];
+}
+
+/*
+ * Given the last length (< 64) bytes of a message and the total length of the
+ * message in bytes, build the final one or two blocks of the message as per the
+ * MD5 specification, with the same padding as Md5Context: a 1 bit, 0 bits until
+ * there are 8 bytes remaining in the block, and the original message length in
+ * bits as a 64-bit little-endian integer. Returns the number of blocks written
+ * to tail.
+ */
+static int md5_pad_tail(const uint8_t* data, size_t length, uint64_t total_length,
+    uint8_t tail[128]) {
+    assert(length < 64);
+    return Md5Context::pad_tail(data, length, total_length, tail);
+}
+
+/*
+ * Convert four words of MD5 state to the 16-byte hash value, storing each word
+ * in little-endian order.
+ */
+static void md5_state_to_bytes(const uint32_t state[4], uint8_t digest[16]) {
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            digest[i * 4 + j] = (state[i] >> (j * 8)) & 0xff;
+        }
+    }
+}
+
+/*
+ * A vector of 32-bit integers with one lane per message, using the GCC vector
+ * extensions. The same type is used for SSE2, AVX2 and AVX-512; the instructions
+ * generated depend on the target of the function the rounds are inlined into.
+ */
+template <int lanes>
+struct Md5Vector {
+    typedef uint32_t type __attribute__((vector_size(lanes * 4)));
+};
+
+/*
+ * Process one 512-bit block for each of several independent messages at once.
+ * Word w of the state of lane l is stored at state[w * lanes + l], and blocks[l]
+ * points to the block for lane l. Each lane runs exactly the rounds of the
+ * unrolled kernel, so lanes never affect each other.
+ */
+template <int lanes>
+static inline __attribute__((always_inline)) void md5_process_chunks(uint32_t* state,
+    const uint8_t* const* blocks) {
+    typedef typename Md5Vector<lanes>::type Vector;
+    Vector chunk[16], v[4], initial[4];
+    for (int j = 0; j < 16; ++j) {
+        for (int l = 0; l < lanes; ++l) {
+            const uint8_t* word = blocks[l] + j * 4;
+            chunk[j][l] = (uint32_t) word[0] | ((uint32_t) word[1] << 8)
+                | ((uint32_t) word[2] << 16) | ((uint32_t) word[3] << 24);
+        }
+    }
+    std::memcpy(initial, state, sizeof(initial));
+    std::memcpy(v, state, sizeof(v));
+    md5_rounds(v, chunk, std::make_integer_sequence<int, 64>());
+    for (int i = 0; i < 4; ++i) {
+        v[i] += initial[i];
+    }
+    std::memcpy(state, v, sizeof(v));
+}
+
+/*
+ * Hash count independent messages, lanes messages at a time. Each lane works
+ * through the full blocks of its message and then the padded tail. When a lane
+ * finishes, its hash is written to digests (16 bytes per message), and the lane
+ * starts on the next message that has not been hashed yet, so messages of
+ * uneven length keep all lanes busy. Idle lanes at the end of the input process
+ * a dummy block and their result is discarded.
+ */
+template <int lanes, void (*process)(uint32_t*, const uint8_t* const*)>
+static void md5_multi_buffer(const uint8_t* const* messages, const size_t* lengths,
+    size_t count, const uint32_t initial_state[4], uint64_t prefix_length, uint8_t* digests) {
+    struct Lane {
+        size_t message;
+        const uint8_t* data;
+        size_t full_blocks;
+        int tail_blocks;
+        int tail_position;
+        uint8_t tail[128];
+    };
+    static const uint8_t dummy_block[64] = {};
+    Lane lane[lanes];
+    uint32_t state[4 * lanes] = {};
+    const uint8_t* blocks[lanes];
+    size_t next_message = 0;
+    int active = 0;
+    for (int l = 0; l < lanes; ++l) {
+        lane[l].message = count;
+    }
+    while (true) {
+        for (int l = 0; l < lanes; ++l) {
+            if (lane[l].message != count || next_message == count) {
+                continue;
+            }
+            size_t length = lengths[next_message];
+            lane[l].message = next_message;
+            lane[l].data = messages[next_message];
+            lane[l].full_blocks = length / 64;
+            lane[l].tail_blocks = md5_pad_tail(messages[next_message] + length / 64 * 64,
+                length % 64, prefix_length + length, lane[l].tail);
+            lane[l].tail_position = 0;
+            for (int w = 0; w < 4; ++w) {
+                state[w * lanes + l] = initial_state[w];
+            }
+            ++next_message;
+            ++active;
+        }
+        if (active == 0) {
+            break;
+        }
+        for (int l = 0; l < lanes; ++l) {
+            if (lane[l].message == count) {
+                blocks[l] = dummy_block;
+            } else if (lane[l].full_blocks > 0) {
+                blocks[l] = lane[l].data;
+            } else {
+                blocks[l] = lane[l].tail + lane[l].tail_position * 64;
+            }
+        }
+        process(state, blocks);
+        for (int l = 0; l < lanes; ++l) {
+            if (lane[l].message == count) {
+                continue;
+            }
+            if (lane[l].full_blocks > 0) {
+                --lane[l].full_blocks;
+                lane[l].data += 64;
+            } else if (++lane[l].tail_position == lane[l].tail_blocks) {
+                uint32_t lane_state[4];
+                for (int w = 0; w < 4; ++w) {
+                    lane_state[w] = state[w * lanes + l];
+                }
+                md5_state_to_bytes(lane_state, digests + lane[l].message * 16);
+                lane[l].message = count;
+                --active;
+            }
+        }
+    }
+}
+
+/*
+ * Block functions for the multi-buffer engine. Each one is compiled for its
+ * instruction set, and the rounds are inlined into it so that every vector
+ * operation uses those instructions. The 4-lane version is built for SSE2 on
+ * x86 and for the native vector unit (such as NEON) everywhere else.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define MD5_X86 1
+#include <x86intrin.h>
+
+__attribute__((target("sse2"), flatten))
+static void md5_process_chunks_sse2(uint32_t* state, const uint8_t* const* blocks) {
+    md5_process_chunks<4>(state, blocks);
+}
+
+__attribute__((target("avx2"), flatten))
+static void md5_process_chunks_avx2(uint32_t* state, const uint8_t* const* blocks) {
+    md5_process_chunks<8>(state, blocks);
+}
+
+__attribute__((target("avx512f"), flatten))
+static void md5_process_chunks_avx512(uint32_t* state, const uint8_t* const* blocks) {
+    md5_process_chunks<16>(state, blocks);
+}
+
+#else
+
+__attribute__((flatten))
+static void md5_process_chunks_vector4(uint32_t* state, const uint8_t* const* blocks) {
+    md5_process_chunks<4>(state, blocks);
+}
+
+#endif
+
+/*
+ * Adapters that let the scalar block functions run in the multi-buffer engine
+ * with a single lane. With one lane, the state layout is the same as state[4].
+ */
+static void md5_process_chunks_reference(uint32_t* state, const uint8_t* const* blocks) {
+    md5_process_chunk(state, blocks[0]);
+}
+
+static void md5_process_chunks_unrolled(uint32_t* state, const uint8_t* const* blocks) {
+    md5_process_chunk_unrolled(state, blocks[0]);
+}
+
+/*
+ * Process count consecutive 512-bit blocks of a single message.
+ */
+static void md5_process_blocks_reference(uint32_t state[4], const uint8_t* data,
+    size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        md5_process_chunk(state, data + i * 64);
+    }
+}
+
+static void md5_process_blocks_unrolled(uint32_t state[4], const uint8_t* data,
+    size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        md5_process_chunk_unrolled(state, data + i * 64);
+    }
+}
+
+static bool md5_always_supported() {
+    return true;
+}
+
+#ifdef MD5_X86
+static bool md5_avx2_supported() {
+    return __builtin_cpu_supports("avx2");
+}
+
+static bool md5_avx512_supported() {
+    return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+/*
+ * The table of engines, ordered from slowest to fastest. SSE2 is part of the
+ * x86-64 baseline, and NEON is part of the AArch64 baseline, so only the wider
+ * x86 engines have to be checked with CPUID at runtime.
+ */
+static const Md5Engine md5_engines[] = {
+    {"reference", md5_always_supported, md5_process_blocks_reference,
+        md5_multi_buffer<1, md5_process_chunks_reference>},
+    {"unrolled", md5_always_supported, md5_process_blocks_unrolled,
+        md5_multi_buffer<1, md5_process_chunks_unrolled>},
+#ifdef MD5_X86
+    {"sse2", md5_always_supported, md5_process_blocks_unrolled,
+        md5_multi_buffer<4, md5_process_chunks_sse2>},
+    {"avx2", md5_avx2_supported, md5_process_blocks_unrolled,
+        md5_multi_buffer<8, md5_process_chunks_avx2>},
+    {"avx512", md5_avx512_supported, md5_process_blocks_unrolled,
+        md5_multi_buffer<16, md5_process_chunks_avx512>},
+#elif defined(__aarch64__)
+    {"neon", md5_always_supported, md5_process_blocks_unrolled,
+        md5_multi_buffer<4, md5_process_chunks_vector4>},
+#else
+    {"vector4", md5_always_supported, md5_process_blocks_unrolled,
+        md5_multi_buffer<4, md5_process_chunks_vector4>},
+#endif
+};
+
+/*
+ * Return the fastest engine supported by this processor.
+ */
+static const Md5Engine* md5_best_engine() {
+    const Md5Engine* best = &md5_engines[0];
+    for (const Md5Engine& engine : md5_engines) {
+        if (engine.supported()) {
+            best = &engine;
+        }
+    }
+    return best;
+}
+
+/*
+ * Return the engine with the given name, or nullptr if there is no such engine
+ * or it is not supported by this processor.
+ */
+const Md5Engine* md5_find_engine(const std::string& name) {
+    for (const Md5Engine& engine : md5_engines) {
+        if (name == engine.name && engine.supported()) {
+            return &engine;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * The engine used for all hashing. It is chosen once at startup: the MD5_ENGINE
+ * environment variable pins a specific engine, and otherwise the fastest one
+ * supported by the processor is used. The --engine argument overrides both.
+ */
+static const Md5Engine* md5_engine = [] {
+    const char* name = std::getenv("MD5_ENGINE");
+    const Md5Engine* engine = name ? md5_find_engine(name) : nullptr;
+    return engine ? engine : md5_best_engine();
+}();
+
+/*
+ * Return the number of engines built into the library, including any that are
+ * not supported by this processor, and the engine at the given index. Engines
+ * are listed from slowest to fastest.
+ */
+size_t md5_engine_count() {
+    return sizeof(md5_engines) / sizeof(md5_engines[0]);
+}
+
+const Md5Engine& md5_engine_at(size_t index) {
+    return md5_engines[index];
+}
+
+/*
+ * Return the engine currently used for hashing.
+ */
+const Md5Engine* md5_current_engine() {
+    return md5_engine;
+}
+
+/*
+ * Use the given engine for all hashing from now on. The engine must be
+ * supported by this processor. This is not synchronized with hashing on other
+ * threads, so it should be called before any hashing starts.
+ */
+void md5_use_engine(const Md5Engine* engine) {
+    md5_engine = engine;
+}
+
+/*
+ * Process count consecutive 512-bit blocks of a single message with the
+ * current engine. This is the block function of Md5Context.
+ */
+void md5_process_blocks(uint32_t state[4], const uint8_t* data, size_t count) {
+    md5_engine->process_blocks(state, data, count);
+}
+
+/*
+ * Hash count independent messages with one call, writing the hash of message i
+ * to digests[16 * i]. Each message continues from initial_state, the state
+ * after a prefix of prefix_length bytes (a multiple of 64) shared by all of
+ * them. This is the entry point for hashing many small messages, such as keys
+ * or packets under one HMAC key. The messages are handled in slices small enough to keep all
+ * bookkeeping on the stack, so no memory is allocated. Within a slice, messages
+ * are grouped by the number of blocks they need after padding, so the lanes of
+ * the multi-buffer engine are filled with messages that finish together and no
+ * lane sits idle waiting for a longer message. Messages shorter than 56 bytes
+ * are a single padded block built on the stack. The messages are counted as
+ * input bytes in the stats unless count_bytes is false, as for the interior
+ * nodes of a tree hash and the outer hashes of HMAC, whose blocks are still
+ * counted.
+ */
+static void md5_batch_from(const uint8_t* const* messages, const size_t* lengths,
+    size_t count, const uint32_t initial_state[4], uint64_t prefix_length, uint8_t* digests,
+    bool count_bytes = true) {
+    STATS_TIME(compress);
+    constexpr size_t slice = 256;
+    for (size_t start = 0; start < count; start += slice) {
+        size_t n = std::min(slice, count - start);
+        uint16_t order[slice];
+        uint64_t blocks[slice];
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = static_cast<uint16_t>(i);
+            blocks[i] = (lengths[start + i] + 8) / 64 + 1;
+            if (count_bytes) {
+                STATS_ADD(bytes, lengths[start + i]);
+            }
+            STATS_ADD(blocks, blocks[i]);
+        }
+        std::sort(order, order + n, [&blocks](uint16_t a, uint16_t b) {
+            return blocks[a] != blocks[b] ? blocks[a] < blocks[b] : a < b;
+        });
+        const uint8_t* grouped_messages[slice];
+        size_t grouped_lengths[slice];
+        uint8_t grouped_digests[slice * 16];
+        for (size_t i = 0; i < n; ++i) {
+            grouped_messages[i] = messages[start + order[i]];
+            grouped_lengths[i] = lengths[start + order[i]];
+        }
+        md5_engine->hash_many(grouped_messages, grouped_lengths, n, initial_state,
+            prefix_length, grouped_digests);
+        for (size_t i = 0; i < n; ++i) {
+            std::memcpy(digests + (start + order[i]) * 16, grouped_digests + i * 16, 16);
+        }
+    }
+}
+
+/*
+ * Hash count independent messages from the initial MD5 state; see
+ * md5_batch_from.
+ */
+void md5_batch(const uint8_t* const* messages, const size_t* lengths, size_t count,
+    uint8_t* digests) {
+    md5_batch_from(messages, lengths, count, md5_initial_state, 0, digests);
+}
+
+/*
+ * Compute the leaves of a tree hash (see md5_tree_root) for the length bytes
+ * at data, split into leaves of leaf_size bytes; the last leaf may be shorter,
+ * and an empty message is a single empty leaf. The value of each leaf is
+ * MD5(0x00 || MD5(leaf)) and is written to digests[16 * i]. The leaves are
+ * independent messages of the same length, so they are hashed together with
+ * md5_batch and fill every lane of the multi-buffer engine.
+ */
+void md5_tree_leaves(const uint8_t* data, size_t length, size_t leaf_size,
+    uint8_t* digests) {
+    size_t count = length == 0 ? 1 : (length - 1) / leaf_size + 1;
+    constexpr size_t slice = 256;
+    for (size_t start = 0; start < count; start += slice) {
+        size_t n = std::min(slice, count - start);
+        const uint8_t* messages[slice];
+        size_t lengths[slice];
+        for (size_t i = 0; i < n; ++i) {
+            size_t offset = (start + i) * leaf_size;
+            messages[i] = data + offset;
+            lengths[i] = std::min(leaf_size, length - offset);
+        }
+        md5_batch(messages, lengths, n, digests + start * 16);
+        uint8_t nodes[slice][17];
+        for (size_t i = 0; i < n; ++i) {
+            nodes[i][0] = 0x00;
+            std::memcpy(nodes[i] + 1, digests + (start + i) * 16, 16);
+            messages[i] = nodes[i];
+            lengths[i] = 17;
+        }
+        md5_batch_from(messages, lengths, n, md5_initial_state, 0, digests + start * 16,
+            false);
+    }
+}
+
+/*
+ * Combine count leaf values from md5_tree_leaves into the root of a tree hash.
+ * Each level hashes pairs of nodes as MD5(0x01 || left || right); an odd node
+ * at the end of a level is carried up unchanged. The prefixes keep leaves and
+ * interior nodes from ever being confused, and the root of a single leaf is
+ * still MD5(0x00 || MD5(message)), so a tree hash never equals the plain MD5
+ * hash of the same message. With no leaves at all, the root is that of an
+ * empty message, which md5_tree_leaves gives a single empty leaf:
+ * MD5(0x00 || MD5("")).
+ */
+void md5_tree_root(const uint8_t* leaf_digests, size_t count, uint8_t root[16]) {
+    if (count == 0) {
+        md5_tree_leaves(nullptr, 0, 1, root);
+        return;
+    }
+    PooledBuffer level(count * 16);
+    std::memcpy(level.data(), leaf_digests, count * 16);
+    constexpr size_t slice = 256;
+    while (count > 1) {
+        size_t pairs = count / 2;
+        for (size_t start = 0; start < pairs; start += slice) {
+            size_t n = std::min(slice, pairs - start);
+            uint8_t nodes[slice * 33];
+            const uint8_t* messages[slice];
+            size_t lengths[slice];
+            for (size_t i = 0; i < n; ++i) {
+                nodes[i * 33] = 0x01;
+                std::memcpy(&nodes[i * 33 + 1], level.data() + (start + i) * 32, 32);
+                messages[i] = &nodes[i * 33];
+                lengths[i] = 33;
+            }
+            md5_batch_from(messages, lengths, n, md5_initial_state, 0,
+                level.data() + start * 16, false);
+        }
+        if (count % 2 != 0) {
+            std::memcpy(level.data() + pairs * 16, level.data() + (count - 1) * 16, 16);
+        }
+        count = (count + 1) / 2;
+    }
+    std::memcpy(root, level.data(), 16);
+}
+
+/*
+ * Write the 32 lowercase hex characters of the digest to text. No terminating
+ * null character is written.
+ */
+void Md5Digest::to_hex(char text[32]) const {
+    hex_encode(bytes.data(), 16, text);
+}
+
+/*
+ * Return the digest as a string of 32 lowercase hex characters.
+ */
+std::string Md5Digest::hex() const {
+    std::string text(32, '\0');
+    to_hex(text.data());
+    return text;
+}
+
+/*
+ * Parse 32 hex characters, in upper or lower case, into digest. Returns false,
+ * leaving digest unchanged, if text is not exactly that.
+ */
+bool Md5Digest::from_hex(std::string_view text, Md5Digest& digest) {
+    Md5Digest parsed;
+    if (text.size() != 32 || !hex_decode(text.data(), 32, parsed.bytes.data())) {
+        return false;
+    }
+    digest = parsed;
+    return true;
+}
+
+/*
+ * Return the hash value of four words of MD5 state.
+ */
+Md5Digest Md5Digest::from_state(const uint32_t state[4]) {
+    Md5Digest digest;
+    md5_state_to_bytes(state, digest.bytes.data());
+    return digest;
+}
+
+/*
+ * Hash a whole message held in memory and return the 16-byte hash.
+ */
+Md5Digest md5_hash(const uint8_t* data, size_t length) {
+    Md5Context context;
+    context.update(data, length);
+    return context.finalize();
+}
+
+/*
+ * As above, but return the hash.
+ */
+Md5Digest Md5Context::finalize() {
+    Md5Digest digest;
+    finalize(digest.data());
+    return digest;
+}
+
+/*
+ * Export the intermediate state of the context as a small versioned blob: the
+ * magic "MD5S", a 32-bit version, the four state words, the 64-bit message
+ * length so far, and the buffered bytes preceded by their count. All integers
+ * are little-endian, so a blob written on one machine can be imported on any
+ * other.
+ */
+std::vector<uint8_t> Md5Context::export_state() const {
+    std::vector<uint8_t> blob = {'M', 'D', '5', 'S'};
+    auto append = [&blob](uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            blob.push_back((value >> (i * 8)) & 0xff);
+        }
+    };
+    append(md5_state_version, 4);
+    for (uint32_t word : state) {
+        append(word, 4);
+    }
+    append(total_length, 8);
+    append(buffer_length, 1);
+    blob.insert(blob.end(), buffer, buffer + buffer_length);
+    return blob;
+}
+
+/*
+ * Replace the state of the context with a blob written by export_state(), so
+ * hashing can continue where it left off. Returns false, leaving the context
+ * unchanged, if the blob is not a valid state of this version.
+ */
+bool Md5Context::import_state(const std::vector<uint8_t>& blob) {
+    auto load = [&blob](size_t offset, int bytes) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            value |= (uint64_t) blob[offset + i] << (i * 8);
+        }
+        return value;
+    };
+    if (blob.size() < 33 || !std::equal(blob.begin(), blob.begin() + 4, "MD5S")
+        || load(4, 4) != md5_state_version || blob[32] >= 64
+        || blob.size() != 33u + blob[32] || load(24, 8) % 64 != blob[32]) {
+        return false;
+    }
+    for (int i = 0; i < 4; ++i) {
+        state[i] = static_cast<uint32_t>(load(8 + i * 4, 4));
+    }
+    total_length = load(24, 8);
+    buffer_length = blob[32];
+    std::copy(blob.begin() + 33, blob.end(), buffer);
+    return true;
+}
+
+/*
+ * Set the key. A key longer than a block is replaced by its MD5 hash, and the
+ * key is padded with zeros to a block, as RFC 2104 specifies. The inner and
+ * outer states are the states after hashing the padded key XORed with 0x36 and
+ * with 0x5c.
+ */
+Md5Hmac::Md5Hmac(const uint8_t* key, size_t key_length) {
+    uint8_t padded_key[64] = {};
+    if (key_length > 64) {
+        Md5Context context;
+        context.update(key, key_length);
+        context.finalize(padded_key);
+    } else {
+        std::memcpy(padded_key, key, key_length);
+    }
+    uint8_t block[64];
+    for (int i = 0; i < 64; ++i) {
+        block[i] = padded_key[i] ^ 0x36;
+    }
+    std::copy(md5_initial_state, md5_initial_state + 4, inner_state);
+    md5_engine->process_blocks(inner_state, block, 1);
+    for (int i = 0; i < 64; ++i) {
+        block[i] = padded_key[i] ^ 0x5c;
+    }
+    std::copy(md5_initial_state, md5_initial_state + 4, outer_state);
+    md5_engine->process_blocks(outer_state, block, 1);
+}
+
+/*
+ * Return a context for streaming a message, already past the inner padded key.
+ */
+Md5Context Md5Hmac::begin() const {
+    return Md5Context(inner_state, 64);
+}
+
+/*
+ * Complete the HMAC of a message streamed through a context from begin(). The
+ * context is reset to a plain MD5 context afterwards. The outer hash of the
+ * 16-byte inner hash is a single padded block, processed directly rather than
+ * through a context, so the stats count its block but not the inner hash as
+ * input bytes.
+ */
+void Md5Hmac::finish(Md5Context& context, uint8_t mac[16]) const {
+    uint8_t inner_digest[16];
+    context.finalize(inner_digest);
+    STATS_TIME(pad);
+    uint8_t tail[128];
+    int tail_blocks = Md5Context::pad_tail(inner_digest, 16, 64 + 16, tail);
+    uint32_t state[4];
+    std::copy(outer_state, outer_state + 4, state);
+    md5_process_blocks(state, tail, tail_blocks);
+    STATS_ADD(blocks, tail_blocks);
+    Md5Digest::from_state(state).store(mac);
+}
+
+/*
+ * As above, but return the HMAC.
+ */
+Md5Digest Md5Hmac::finish(Md5Context& context) const {
+    Md5Digest mac;
+    finish(context, mac.data());
+    return mac;
+}
+
+/*
+ * Compute the HMAC of one message held in memory.
+ */
+void Md5Hmac::mac(const uint8_t* message, size_t length, uint8_t mac[16]) const {
+    Md5Context context = begin();
+    context.update(message, length);
+    finish(context, mac);
+}
+
+/*
+ * As above, but return the HMAC.
+ */
+Md5Digest Md5Hmac::mac(const uint8_t* message, size_t length) const {
+    Md5Digest result;
+    mac(message, length, result.data());
+    return result;
+}
+
+/*
+ * Compute the HMAC of count messages, writing the HMAC of message i to
+ * macs[16 * i]. The inner hashes are computed together through the
+ * multi-buffer engine from the inner state, and then the outer hashes, each a
+ * single block, from the outer state. Only the messages count as input bytes
+ * in the stats.
+ */
+void Md5Hmac::mac_batch(const uint8_t* const* messages, const size_t* lengths, size_t count,
+    uint8_t* macs) const {
+    md5_batch_from(messages, lengths, count, inner_state, 64, macs);
+    constexpr size_t slice = 256;
+    for (size_t start = 0; start < count; start += slice) {
+        size_t n = std::min(slice, count - start);
+        uint8_t inner_digests[slice * 16];
+        const uint8_t* outer_messages[slice];
+        size_t outer_lengths[slice];
+        std::memcpy(inner_digests, macs + start * 16, n * 16);
+        for (size_t i = 0; i < n; ++i) {
+            outer_messages[i] = inner_digests + i * 16;
+            outer_lengths[i] = 16;
+        }
+        md5_batch_from(outer_messages, outer_lengths, n, outer_state, 64, macs + start * 16,
+            false);
+    }
+}
+
+/*
+ * Hash a message with nothing but the reference block function: the full
+ * blocks of the message one at a time, and then the tail built by
+ * md5_pad_tail. The message continues from initial_state, the state after a
+ * prefix of prefix_length bytes. Every other path is checked against this.
+ */
+static Md5Digest md5_reference_hash(const uint8_t* data, size_t length,
+    const uint32_t initial_state[4] = md5_initial_state, uint64_t prefix_length = 0) {
+    uint32_t state[4];
+    std::copy(initial_state, initial_state + 4, state);
+    for (size_t i = 0; i < length / 64; ++i) {
+        md5_process_chunk(state, data + i * 64);
+    }
+    uint8_t tail[128];
+    int blocks = md5_pad_tail(data + length / 64 * 64, length % 64, prefix_length + length, tail);
+    for (int i = 0; i < blocks; ++i) {
+        md5_process_chunk(state, tail + i * 64);
+    }
+    return Md5Digest::from_state(state);
+}
+
+/*
+ * Hash a message through an Md5Context running on the given engine, passing it
+ * to update() in pieces of the given sizes, which add up to length.
+ */
+static Md5Digest md5_streamed_hash(const Md5Engine& engine, const uint8_t* data,
+    const std::vector<size_t>& pieces) {
+    const Md5Engine* previous = md5_engine;
+    md5_engine = &engine;
+    Md5Context context;
+    for (size_t piece : pieces) {
+        context.update(data, piece);
+        data += piece;
+    }
+    Md5Digest digest = context.finalize();
+    md5_engine = previous;
+    return digest;
+}
+
+/*
+ * Check one message from the initial state against md5_reference_hash on
+ * every supported engine: streamed through an Md5Context, in one piece and in
+ * random pieces, and as a batch of one through hash_many. md5_hash and the
+ * compile-time md5() are checked too. label describes the message in errors.
+ */
+static bool md5_check_message(const uint8_t* data, size_t length, std::mt19937& rng,
+    const std::string& label) {
+    Md5Digest expected = md5_reference_hash(data, length);
+    std::vector<size_t> whole(1, length);
+    for (const Md5Engine& engine : md5_engines) {
+        if (!engine.supported()) {
+            continue;
+        }
+        Md5Digest batched;
+        engine.hash_many(&data, &length, 1, md5_initial_state, 0, batched.data());
+        if (batched != expected || md5_streamed_hash(engine, data, whole) != expected) {
+            std::cerr << "Error: " << engine.name << " engine mismatch for " << label << std::endl;
+            return false;
+        }
+        if (md5_streamed_hash(engine, data, block_hash_random_pieces(length, rng)) != expected) {
+            std::cerr << "Error: " << engine.name << " engine mismatch in streamed updates for "
+                << label << std::endl;
+            return false;
+        }
+    }
+    std::array<uint8_t, 16> folded = md5(std::string_view(
+        reinterpret_cast<const char*>(data), length));
+    if (md5_hash(data, length) != expected
+        || !std::equal(folded.begin(), folded.end(), expected.begin())) {
+        std::cerr << "Error: md5_hash or constexpr md5 mismatch for " << label << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Check a batch of messages from the given state against md5_reference_hash
+ * on every supported engine, and through md5_batch when starting from the
+ * initial state.
+ */
+static bool md5_check_batch(const std::vector<std::vector<uint8_t>>& batch,
+    const uint32_t initial_state[4], uint64_t prefix_length, const std::string& label) {
+    size_t count = batch.size();
+    std::vector<const uint8_t*> messages(count);
+    std::vector<size_t> lengths(count);
+    std::vector<uint8_t> expected(count * 16), actual(count * 16);
+    for (size_t i = 0; i < count; ++i) {
+        messages[i] = batch[i].data();
+        lengths[i] = batch[i].size();
+        md5_reference_hash(messages[i], lengths[i], initial_state, prefix_length)
+            .store(&expected[i * 16]);
+    }
+    for (const Md5Engine& engine : md5_engines) {
+        if (!engine.supported()) {
+            continue;
+        }
+        engine.hash_many(messages.data(), lengths.data(), count, initial_state, prefix_length,
+            actual.data());
+        if (actual != expected) {
+            std::cerr << "Error: " << engine.name << " engine batch mismatch for " << label
+                << std::endl;
+            return false;
+        }
+    }
+    if (prefix_length == 0) {
+        md5_batch(messages.data(), lengths.data(), count, actual.data());
+        if (actual != expected) {
+            std::cerr << "Error: md5_batch mismatch for " << label << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Check the test suite of RFC 1321, appendix A.5, through every path.
+ */
+static bool md5_check_known_answers(std::mt19937& rng) {
+    static const char* const inputs[] = {
+        "", "a", "abc", "message digest", "abcdefghijklmnopqrstuvwxyz",
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+        "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+    };
+    static const char* const expected[] = {
+        "d41d8cd98f00b204e9800998ecf8427e", "0cc175b9c0f1b6a831c399e269772661",
+        "900150983cd24fb0d6963f7d28e17f72", "f96b697d7cb7938d525a2f31aaf161d0",
+        "c3fcd3d76192e4007dfb496cca67e13b", "d174ab98d277d9f5a5611c2c9f419d9f",
+        "57edf4a22be3c955ac49da2e2107b67a",
+    };
+    std::vector<std::vector<uint8_t>> batch;
+    for (size_t t = 0; t < std::size(inputs); ++t) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(inputs[t]);
+        size_t length = std::strlen(inputs[t]);
+        std::string label = "RFC 1321 test case " + std::to_string(t + 1);
+        if (md5_reference_hash(data, length).hex() != expected[t]) {
+            std::cerr << "Error: reference mismatch for " << label << std::endl;
+            return false;
+        }
+        if (!md5_check_message(data, length, rng, label)) {
+            return false;
+        }
+        batch.emplace_back(data, data + length);
+    }
+    return md5_check_batch(batch, md5_initial_state, 0, "the RFC 1321 test suite");
+}
+
+/*
+ * Check every length up to three blocks and a byte, which includes the
+ * lengths at which md5_pad_tail changes behavior: up to 55 bytes the padding
+ * fits in the last block, from 56 it needs another, and at 64 the message
+ * fills a block exactly. The lengths are also hashed together as one batch,
+ * from the initial state and from a midstate.
+ */
+static bool md5_check_boundaries(std::mt19937& rng) {
+    std::vector<std::vector<uint8_t>> batch;
+    for (size_t length = 0; length <= 3 * 64 + 1; ++length) {
+        std::vector<uint8_t> message(length);
+        for (uint8_t& byte : message) {
+            byte = rng() & 0xff;
+        }
+        if (!md5_check_message(message.data(), length, rng,
+                "a " + std::to_string(length) + "-byte message")) {
+            return false;
+        }
+        batch.push_back(std::move(message));
+    }
+    uint32_t midstate[4];
+    for (uint32_t& word : midstate) {
+        word = rng();
+    }
+    return md5_check_batch(batch, md5_initial_state, 0, "boundary lengths")
+        && md5_check_batch(batch, midstate, 64, "boundary lengths from a midstate");
+}
+
+/*
+ * Check that the unrolled block function, and the block function of every
+ * supported engine, give the same result as the reference loop in
+ * md5_process_chunk for random blocks from random states.
+ */
+static bool md5_check_kernels(int iterations, std::mt19937& rng) {
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        uint8_t blocks[4 * 64];
+        for (uint8_t& byte : blocks) {
+            byte = rng() & 0xff;
+        }
+        uint32_t expected[4], actual[4];
+        for (int i = 0; i < 4; ++i) {
+            expected[i] = actual[i] = rng();
+        }
+        uint32_t initial[4];
+        std::copy(expected, expected + 4, initial);
+        md5_process_chunk(expected, blocks);
+        md5_process_chunk_unrolled(actual, blocks);
+        if (!std::equal(expected, expected + 4, actual)) {
+            std::cerr << "Error: Unrolled kernel mismatch in iteration "
+                << iteration << std::endl;
+            return false;
+        }
+        size_t count = 1 + rng() % 4;
+        std::copy(initial, initial + 4, expected);
+        md5_process_blocks_reference(expected, blocks, count);
+        for (const Md5Engine& engine : md5_engines) {
+            if (!engine.supported()) {
+                continue;
+            }
+            std::copy(initial, initial + 4, actual);
+            engine.process_blocks(actual, blocks, count);
+            if (!std::equal(expected, expected + 4, actual)) {
+                std::cerr << "Error: " << engine.name << " block function mismatch in iteration "
+                    << iteration << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Compute the root of a tree hash with md5_reference_hash alone, following
+ * the definitions in md5_tree_leaves and md5_tree_root.
+ */
+static Md5Digest md5_reference_tree(const uint8_t* data, size_t length, size_t leaf_size) {
+    std::vector<Md5Digest> level;
+    for (size_t offset = 0; offset == 0 || offset < length; offset += leaf_size) {
+        uint8_t node[33] = {0x00};
+        md5_reference_hash(data + offset, std::min(leaf_size, length - offset)).store(node + 1);
+        level.push_back(md5_reference_hash(node, 17));
+    }
+    while (level.size() > 1) {
+        std::vector<Md5Digest> parents;
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            uint8_t node[33] = {0x01};
+            level[i].store(node + 1);
+            level[i + 1].store(node + 17);
+            parents.push_back(md5_reference_hash(node, 33));
+        }
+        if (level.size() % 2 != 0) {
+            parents.push_back(level.back());
+        }
+        level = std::move(parents);
+    }
+    return level[0];
+}
+
+/*
+ * The differential fuzzer: random messages of random lengths, mostly short
+ * but some many blocks long, each checked through every engine with a random
+ * chunking of updates; random batches of uneven length, from the initial
+ * state and from random midstates; and tree hashes of random messages with
+ * random leaf sizes, including enough leaves to span several slices in
+ * md5_tree_root, which must also give a tree of no leaves the root of an
+ * empty message.
+ */
+static bool md5_fuzz(int iterations, std::mt19937& rng) {
+    if (md5_tree_root(nullptr, 0) != md5_reference_tree(nullptr, 0, 1)) {
+        std::cerr << "Error: tree hash mismatch for no leaves" << std::endl;
+        return false;
+    }
+    for (int iteration = 0; iteration < iterations / 10 + 1; ++iteration) {
+        size_t length = rng() % 4 == 0 ? rng() % 20000 : rng() % 300;
+        std::vector<uint8_t> message(length);
+        for (uint8_t& byte : message) {
+            byte = rng() & 0xff;
+        }
+        if (!md5_check_message(message.data(), length, rng,
+                "fuzz iteration " + std::to_string(iteration))) {
+            return false;
+        }
+    }
+    for (int iteration = 0; iteration < iterations / 100 + 1; ++iteration) {
+        std::vector<std::vector<uint8_t>> batch(rng() % 600);
+        for (std::vector<uint8_t>& message : batch) {
+            message.resize(rng() % 300);
+            for (uint8_t& byte : message) {
+                byte = rng() & 0xff;
+            }
+        }
+        uint32_t midstate[4];
+        for (uint32_t& word : midstate) {
+            word = rng();
+        }
+        std::string label = "batch iteration " + std::to_string(iteration);
+        if (!md5_check_batch(batch, md5_initial_state, 0, label)
+            || !md5_check_batch(batch, midstate, 64 * (1 + rng() % 4), label + " from a midstate")) {
+            return false;
+        }
+        size_t tree_length = rng() % 40000;
+        size_t leaf_size = 1 + rng() % (rng() % 2 == 0 ? 16 : 4096);
+        std::vector<uint8_t> tree_message(tree_length);
+        for (uint8_t& byte : tree_message) {
+            byte = rng() & 0xff;
+        }
+        size_t count = tree_length == 0 ? 1 : (tree_length - 1) / leaf_size + 1;
+        std::vector<Md5Digest> leaves(count);
+        md5_tree_leaves(tree_message.data(), tree_length, leaf_size, leaves.data());
+        Md5Digest root = md5_tree_root(leaves.data(), count);
+        if (root != md5_reference_tree(tree_message.data(), tree_length, leaf_size)) {
+            std::cerr << "Error: tree hash mismatch in iteration " << iteration << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Check every fast path against the reference block function before it is
+ * trusted: the test suite of RFC 1321 and every length around the padding
+ * boundaries through every engine, random blocks through every block
+ * function, and the differential fuzzer. HMAC-MD5 is checked against the test
+ * cases of RFC 2202, one message at a time, streamed and batched. The number
+ * of iterations scales the random checks. Returns true if everything matches.
+ */
+bool md5_self_test(int iterations) {
+    std::mt19937 rng(12345);
+    if (!md5_check_known_answers(rng) || !md5_check_boundaries(rng)
+        || !md5_check_kernels(iterations, rng) || !md5_fuzz(iterations, rng)) {
+        return false;
+    }
+
+    const std::pair<std::string, std::string> hmac_inputs[] = {
+        {std::string(16, '\x0b'), "Hi There"},
+        {"Jefe", "what do ya want for nothing?"},
+        {std::string(16, '\xaa'), std::string(50, '\xdd')},
+        {std::string(80, '\xaa'), "Test Using Larger Than Block-Size Key - Hash Key First"},
+    };
+    static const char* const hmac_expected[] = {
+        "9294727a3638bb1c13f48ef8158bfc9d", "750c783e6ab0b503eaa86e310a5db738",
+        "56be34521d144c88dbb8c733f0e8b3f6", "6b1ab7fe4bd7bf8f0b62e6ce61b9d0cd",
+    };
+    for (size_t t = 0; t < 4; ++t) {
+        const std::string& key = hmac_inputs[t].first;
+        const std::string& message = hmac_inputs[t].second;
+        Md5Hmac hmac(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(message.data());
+        Md5Digest mac = hmac.mac(data, message.size());
+        Md5Context context = hmac.begin();
+        context.update(data, message.size() / 2);
+        context.update(data + message.size() / 2, message.size() - message.size() / 2);
+        Md5Digest streamed = hmac.finish(context);
+        size_t count = 1 + rng() % 40;
+        std::vector<const uint8_t*> messages(count, data);
+        std::vector<size_t> lengths(count, message.size());
+        std::vector<Md5Digest> batched(count);
+        hmac.mac_batch(messages.data(), lengths.data(), count, batched.data());
+        Md5Digest parsed;
+        bool consistent = mac == streamed && Md5Digest::from_hex(mac.hex(), parsed)
+            && parsed == mac;
+        for (size_t i = 0; i < count; ++i) {
+            consistent = consistent && batched[i] == mac;
+        }
+        if (mac.hex() != hmac_expected[t] || !consistent) {
+            std::cerr << "Error: HMAC-MD5 mismatch in RFC 2202 test case " << t + 1 << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The C interface is a thin layer over the C++ one. The opaque md5_context
+ * wraps an Md5Context, and allocation failures are reported by returning
+ * nullptr rather than by throwing across the C boundary.
+ */
+struct md5_context {
+    Md5Context context;
+};
+
+md5_context* md5_context_new(void) {
+    return new (std::nothrow) md5_context();
+}
+
+void md5_context_update(md5_context* context, const void* data, size_t length) {
+    context->context.update(static_cast<const uint8_t*>(data), length);
+}
+
+void md5_context_final(md5_context* context, uint8_t digest[16]) {
+    context->context.finalize(digest);
+}
+
+void md5_context_free(md5_context* context) {
+    delete context;
+}
+
+void md5_digest(const void* data, size_t length, uint8_t digest[16]) {
+    Md5Context context;
+    context.update(static_cast<const uint8_t*>(data), length);
+    context.finalize(digest);
+}
+
+void md5_digest_batch(const uint8_t* const* messages, const size_t* lengths,
+    size_t count, uint8_t* digests) {
+    md5_batch(messages, lengths, count, digests);
+}
+
+void md5_hmac(const void* key, size_t key_length, const void* message, size_t length,
+    uint8_t mac[16]) {
+    Md5Hmac(static_cast<const uint8_t*>(key), key_length).mac(
+        static_cast<const uint8_t*>(message), length, mac);
+}
+
+struct md5_hmac_key {
+    Md5Hmac hmac;
+};
+
+md5_hmac_key* md5_hmac_key_new(const void* key, size_t key_length) {
+    return new (std::nothrow) md5_hmac_key{Md5Hmac(static_cast<const uint8_t*>(key), key_length)};
+}
+
+void md5_hmac_key_mac(const md5_hmac_key* key, const void* message, size_t length,
+    uint8_t mac[16]) {
+    key->hmac.mac(static_cast<const uint8_t*>(message), length, mac);
+}
+
+void md5_hmac_key_batch(const md5_hmac_key* key, const uint8_t* const* messages,
+    const size_t* lengths, size_t count, uint8_t* macs) {
+    key->hmac.mac_batch(messages, lengths, count, macs);
+}
+
+void md5_hmac_key_free(md5_hmac_key* key) {
+    delete key;
+}
+
+int md5_set_engine(const char* name) {
+    const Md5Engine* engine = md5_find_engine(name);
+    if (engine == nullptr) {
+        return 0;
+    }
+    md5_use_engine(engine);
+    return 1;
+}
+
+const char* md5_engine_name(void) {
+    return md5_engine->name;
+}
@@ -0,0 +1,241 @@
+/*
+ * libmd5.h
+ *
+ * The public interface of the MD5 library: one-shot, streaming and batch
+ * hashing, and the choice of engine. The C++ interface is below; a plain C
+ * interface with the same functionality follows it, so the library can be
+ * linked into programs written in other languages without a C++ runtime in
+ * their headers.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+
+#include "../block_hash.h"
+#include "../byte_span.h"
+#include "md5_constexpr.h"
+#include <array>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/*
+ * An MD5 hash held by value: the 16 bytes in the order MD5 defines them, so
+ * returning or copying one never touches the heap. The bytes are the same on
+ * every machine, so store() and load() are a portable serialization, and
+ * from_state() writes the state words in little-endian order whatever the byte
+ * order of the host. Digests compare by their bytes and have a std::hash, so
+ * they can key a std::unordered_map.
+ */
+struct Md5Digest {
+    std::array<uint8_t, 16> bytes;
+
+    static constexpr size_t size() { return 16; }
+    uint8_t* data() { return bytes.data(); }
+    const uint8_t* data() const { return bytes.data(); }
+    const uint8_t* begin() const { return bytes.data(); }
+    const uint8_t* end() const { return bytes.data() + 16; }
+
+    void to_hex(char text[32]) const;
+    std::string hex() const;
+    static bool from_hex(std::string_view text, Md5Digest& digest);
+
+    void store(uint8_t out[16]) const { std::memcpy(out, bytes.data(), 16); }
+    static Md5Digest load(const uint8_t in[16]) {
+        Md5Digest digest;
+        std::memcpy(digest.bytes.data(), in, 16);
+        return digest;
+    }
+    static Md5Digest from_state(const uint32_t state[4]);
+
+    friend bool operator==(const Md5Digest& a, const Md5Digest& b) { return a.bytes == b.bytes; }
+    friend bool operator!=(const Md5Digest& a, const Md5Digest& b) { return a.bytes != b.bytes; }
+    friend bool operator<(const Md5Digest& a, const Md5Digest& b) { return a.bytes < b.bytes; }
+};
+
+static_assert(std::is_trivially_copyable_v<Md5Digest> && sizeof(Md5Digest) == 16);
+
+/*
+ * The bytes of an MD5 hash are already uniformly distributed, so the first
+ * eight, read in a fixed order, are as good a hash as any.
+ */
+template <>
+struct std::hash<Md5Digest> {
+    size_t operator()(const Md5Digest& digest) const noexcept {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i) {
+            value |= (uint64_t) digest.bytes[i] << (i * 8);
+        }
+        return static_cast<size_t>(value);
+    }
+};
+
+/*
+ * An MD5 engine is a pair of functions: one that processes consecutive blocks of
+ * a single message, used by Md5Context, and one that hashes many independent
+ * messages at once. A single message is a serial chain of blocks, so the SIMD
+ * engines use the unrolled kernel for it and only differ in how many messages
+ * they hash at once. hash_many continues every message from the same state,
+ * initial_state, reached after hashing a prefix of prefix_length bytes.
+ */
+struct Md5Engine {
+    const char* name;
+    bool (*supported)();
+    void (*process_blocks)(uint32_t state[4], const uint8_t* data, size_t count);
+    void (*hash_many)(const uint8_t* const* messages, const size_t* lengths,
+        size_t count, const uint32_t initial_state[4], uint64_t prefix_length,
+        uint8_t* digests);
+};
+
+
+size_t md5_engine_count();
+const Md5Engine& md5_engine_at(size_t index);
+const Md5Engine* md5_find_engine(const std::string& name);
+const Md5Engine* md5_current_engine();
+void md5_use_engine(const Md5Engine* engine);
+
+Md5Digest md5_hash(const uint8_t* data, size_t length);
+inline Md5Digest md5_hash(ByteSpan message) {
+    return md5_hash(message.data(), message.size());
+}
+void md5_batch(const uint8_t* const* messages, const size_t* lengths, size_t count,
+    uint8_t* digests);
+void md5_tree_leaves(const uint8_t* data, size_t length, size_t leaf_size,
+    uint8_t* digests);
+void md5_tree_root(const uint8_t* leaf_digests, size_t count, uint8_t root[16]);
+
+/*
+ * The same batch and tree functions writing Md5Digests. An array of Md5Digest
+ * has the layout of the packed 16-byte hashes the functions above use.
+ */
+inline void md5_batch(const uint8_t* const* messages, const size_t* lengths, size_t count,
+    Md5Digest* digests) {
+    md5_batch(messages, lengths, count, reinterpret_cast<uint8_t*>(digests));
+}
+inline void md5_tree_leaves(const uint8_t* data, size_t length, size_t leaf_size,
+    Md5Digest* digests) {
+    md5_tree_leaves(data, length, leaf_size, reinterpret_cast<uint8_t*>(digests));
+}
+inline Md5Digest md5_tree_root(const Md5Digest* leaf_digests, size_t count) {
+    Md5Digest root;
+    md5_tree_root(reinterpret_cast<const uint8_t*>(leaf_digests), count, root.data());
+    return root;
+}
+
+bool md5_self_test(int iterations);
+
+void md5_process_blocks(uint32_t state[4], const uint8_t* data, size_t count);
+
+/*
+ * The parameters of MD5 for BlockHashContext. Blocks are processed by the
+ * current engine.
+ */
+struct Md5 {
+    static constexpr size_t state_words = 4;
+    static constexpr size_t digest_size = 16;
+    static constexpr bool big_endian = false;
+    static constexpr const uint32_t* initial_state = md5_initial_state;
+    static void process_blocks(uint32_t state[4], const uint8_t* data, size_t count) {
+        md5_process_blocks(state, data, count);
+    }
+};
+
+/*
+ * A streaming MD5 context: the buffering and padding of BlockHashContext, with
+ * the hash returned as an Md5Digest and the intermediate state exportable, so
+ * hashing a long message can be resumed in another process.
+ */
+class Md5Context : public BlockHashContext<Md5> {
+public:
+    Md5Context() = default;
+    Md5Context(const uint32_t midstate[4], uint64_t length)
+        : BlockHashContext(midstate, length) {}
+
+    using BlockHashContext::update;
+    void update(ByteSpan bytes) { update(bytes.data(), bytes.size()); }
+    Md5Digest finalize();
+    void finalize(uint8_t digest[16]) { BlockHashContext::finalize(digest); }
+
+    std::vector<uint8_t> export_state() const;
+    bool import_state(const std::vector<uint8_t>& blob);
+
+private:
+    /*
+     * The version of the layout written by export_state().
+     */
+    static constexpr uint32_t md5_state_version = 1;
+};
+
+/*
+ * HMAC-MD5 as specified in RFC 2104, under a fixed key. The inner and outer
+ * padded keys are hashed once, when the key is set, so a message costs only its
+ * own blocks and one block for the outer hash. A message can be authenticated
+ * in one call, streamed through a context from begin() and completed with
+ * finish(), or batched with others under the same key through the
+ * multi-buffer engine.
+ */
+class Md5Hmac {
+public:
+    Md5Hmac(const uint8_t* key, size_t key_length);
+
+    Md5Context begin() const;
+    void finish(Md5Context& context, uint8_t mac[16]) const;
+    Md5Digest finish(Md5Context& context) const;
+    void mac(const uint8_t* message, size_t length, uint8_t mac[16]) const;
+    Md5Digest mac(const uint8_t* message, size_t length) const;
+    Md5Digest mac(ByteSpan message) const { return mac(message.data(), message.size()); }
+    void mac_batch(const uint8_t* const* messages, const size_t* lengths, size_t count,
+        uint8_t* macs) const;
+    void mac_batch(const uint8_t* const* messages, const size_t* lengths, size_t count,
+        Md5Digest* macs) const {
+        mac_batch(messages, lengths, count, reinterpret_cast<uint8_t*>(macs));
+    }
+
+private:
+    uint32_t inner_state[4];
+    uint32_t outer_state[4];
+};
+
+extern "C" {
+#endif
+
+/*
+ * The C interface. A context is created with md5_context_new, fed with
+ * md5_context_update, and md5_context_final writes the 16-byte hash and resets
+ * the context for reuse. md5_hmac computes one HMAC-MD5; to authenticate many
+ * messages under one key, create an md5_hmac_key once and use it for each
+ * message or batch. md5_set_engine returns 0 if the named engine does not
+ * exist or is not supported by this processor, leaving the engine unchanged.
+ */
+typedef struct md5_context md5_context;
+typedef struct md5_hmac_key md5_hmac_key;
+
+md5_context* md5_context_new(void);
+void md5_context_update(md5_context* context, const void* data, size_t length);
+void md5_context_final(md5_context* context, uint8_t digest[16]);
+void md5_context_free(md5_context* context);
+void md5_digest(const void* data, size_t length, uint8_t digest[16]);
+void md5_digest_batch(const uint8_t* const* messages, const size_t* lengths,
+    size_t count, uint8_t* digests);
+void md5_hmac(const void* key, size_t key_length, const void* message, size_t length,
+    uint8_t mac[16]);
+md5_hmac_key* md5_hmac_key_new(const void* key, size_t key_length);
+void md5_hmac_key_mac(const md5_hmac_key* key, const void* message, size_t length,
+    uint8_t mac[16]);
+void md5_hmac_key_batch(const md5_hmac_key* key, const uint8_t* const* messages,
+    const size_t* lengths, size_t count, uint8_t* macs);
+void md5_hmac_key_free(md5_hmac_key* key);
+int md5_set_engine(const char* name);
+const char* md5_engine_name(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+/*
+ * md5_constexpr.h
+ *
+ * The MD5 tables and the reference block function, written so the compiler
+ * can evaluate them. md5() hashes a string at compile time, so digests of
+ * fixed strings cost nothing at run time:
+ *
+ *   constexpr auto digest = md5("config.key");
+ *
+ * The same block function is the reference kernel of the library, so the
+ * compile-time and run-time hashes come from one implementation.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+/*
+ * The initial MD5 state is a hard-coded constant split into four 32-bit words.
+ */
+inline constexpr uint32_t md5_initial_state[4] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+};
+
+namespace md5_detail {
+
+/*
+ * A table of constants used in the MD5 algorithm. These constants are used in
+ * the main loop of the algorithm to update the state of the hash function.
+ */
+inline constexpr uint32_t K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+/*
+ * A table of shift amounts used in the MD5 algorithm. These shift amounts are
+ * used in the main loop of the algorithm to update the state of the hash function.
+ */
+inline constexpr int S[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+/*
+ * Rotate a 32-bit integer left by n bits.
+ */
+constexpr uint32_t rotate(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+/*
+ * Process a 512-bit block of the message, already loaded into 16 little-endian
+ * 32-bit words, in 64 rounds. The result is added to the four words of state
+ * in place.
+ */
+constexpr void process_chunk(uint32_t state[4], const uint32_t chunk[16]) {
+    uint32_t A = state[0], B = state[1], C = state[2], D = state[3];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t input_word = 0, fghi = 0;
+        if (i < 16) {
+            input_word = chunk[i];
+            fghi = (B & C) | ((~B) & D);
+        } else if (i < 32) {
+            input_word = chunk[(5 * i + 1) % 16];
+            fghi = (D & B) | ((~D) & C);
+        } else if (i < 48) {
+            input_word = chunk[(3 * i + 5) % 16];
+            fghi = B ^ C ^ D;
+        } else {
+            input_word = chunk[(7 * i) % 16];
+            fghi = C ^ (B | (~D));
+        }
+        uint32_t temp = D;
+        D = C;
+        C = B;
+        B = rotate(fghi + A + input_word + K[i], S[i]) + B;
+        A = temp;
+    }
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+}
+
+} // namespace md5_detail
+
+/*
+ * Return the MD5 hash of message. The padding is generated block by block while
+ * the message words are loaded, since a constant expression cannot allocate a
+ * padded copy of the message. At run time this is the reference kernel with no
+ * engine dispatch; use md5_hash or Md5Context for anything large.
+ */
+constexpr std::array<uint8_t, 16> md5(std::string_view message) {
+    uint32_t state[4] = {
+        md5_initial_state[0], md5_initial_state[1], md5_initial_state[2], md5_initial_state[3],
+    };
+    size_t length = message.size();
+    size_t total = (length + 8) / 64 * 64 + 64;
+    uint64_t bit_length = (uint64_t) length * 8;
+    for (size_t block = 0; block < total; block += 64) {
+        uint32_t chunk[16] = {};
+        for (size_t j = 0; j < 64; ++j) {
+            size_t i = block + j;
+            uint32_t byte = 0;
+            if (i < length) {
+                byte = (uint8_t) message[i];
+            } else if (i == length) {
+                byte = 0x80;
+            } else if (i >= total - 8) {
+                byte = (bit_length >> ((i - (total - 8)) * 8)) & 0xff;
+            }
+            chunk[j / 4] |= byte << (j % 4 * 8);
+        }
+        md5_detail::process_chunk(state, chunk);
+    }
+    std::array<uint8_t, 16> digest = {};
+    for (size_t i = 0; i < 16; ++i) {
+        digest[i] = (state[i / 4] >> (i % 4 * 8)) & 0xff;
+    }
+    return digest;
+}
@@ -0,0 +1,643 @@
+/*
+ * md5_server.cpp
+ *
+ * The hash server declared in md5_server.h. Every connection has its own
+ * thread, up to md5_server_max_connections at once, which reads all the requests the client has sent so far as one
+ * round, waits for them and writes their responses with a single send. Message
+ * requests from every connection go to one dispatcher thread, which hashes
+ * whatever has queued up since its last batch through the multi-buffer engine,
+ * so pipelined and concurrent requests share its lanes instead of each taking
+ * a turn. File requests run on a persistent thread pool, and only for regular
+ * files under the roots the server was started with.
+ *
+ */
+
+#include "md5_server.h"
+#include "../thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+/*
+ * The server uses POSIX sockets, so daemon mode is not available on Windows.
+ */
+int md5_serve(const std::string&, size_t, const Md5Hmac*,
+    const std::function<Md5Digest(const MappedFile&)>&, const std::vector<std::string>&) {
+    std::cerr << "Error: Daemon mode is not supported on Windows." << std::endl;
+    return 1;
+}
+
+#else
+
+/*
+ * The requests of one round of a connection. The connection thread waits until
+ * remaining drops to zero.
+ */
+struct Md5Round {
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining = 0;
+};
+
+/*
+ * One request and, once it is complete, its result. The payload points into
+ * the receive buffer of the connection, which is left alone until the round
+ * is complete.
+ */
+struct Md5Request {
+    uint8_t type;
+    const uint8_t* payload;
+    uint32_t length;
+    std::chrono::steady_clock::time_point received;
+    Md5Round* round;
+    bool ok;
+    Md5Digest digest;
+    std::string text;
+};
+
+/*
+ * Raise value to candidate if candidate is larger.
+ */
+static void md5_store_max(std::atomic<uint64_t>& value, uint64_t candidate) {
+    uint64_t current = value.load(std::memory_order_relaxed);
+    while (current < candidate
+        && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+    }
+}
+
+class Md5Server {
+public:
+    Md5Server(size_t thread_count, const Md5Hmac* hmac,
+        const std::function<Md5Digest(const MappedFile&)>& hash_file,
+        const std::vector<std::filesystem::path>& file_roots);
+    ~Md5Server();
+
+    Md5Server(const Md5Server&) = delete;
+    Md5Server& operator=(const Md5Server&) = delete;
+
+    bool admit();
+    void release();
+    void handle_connection(int fd);
+
+private:
+    void dispatch_loop();
+    void submit(Md5Request& request);
+    void complete(Md5Request& request);
+    std::string counters() const;
+    bool under_roots(const std::filesystem::path& path) const;
+    int open_file(const std::string& path, std::string& error) const;
+
+    const Md5Hmac* hmac;
+    std::function<Md5Digest(const MappedFile&)> hash_file;
+    std::vector<std::filesystem::path> file_roots;
+    ThreadPool pool;
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::vector<Md5Request*> queue;
+    bool stopping;
+
+    std::atomic<uint64_t> requests, completed, messages, files, errors, bytes, batches, batched;
+    std::atomic<uint64_t> queue_depth, max_queue_depth, latency_total, latency_max;
+    std::atomic<uint64_t> connections, connections_total, connections_rejected;
+
+    std::thread dispatcher;
+};
+
+Md5Server::Md5Server(size_t thread_count, const Md5Hmac* hmac,
+    const std::function<Md5Digest(const MappedFile&)>& hash_file,
+    const std::vector<std::filesystem::path>& file_roots)
+    : hmac(hmac), hash_file(hash_file), file_roots(file_roots), pool(thread_count),
+      stopping(false), requests(0), completed(0), messages(0), files(0), errors(0), bytes(0),
+      batches(0), batched(0), queue_depth(0), max_queue_depth(0), latency_total(0),
+      latency_max(0), connections(0), connections_total(0), connections_rejected(0),
+      dispatcher([this] { dispatch_loop(); }) {
+}
+
+/*
+ * Stop the dispatcher once the messages already queued are hashed.
+ */
+Md5Server::~Md5Server() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_changed.notify_all();
+    dispatcher.join();
+}
+
+/*
+ * Hash queued messages until the server stops. Every pass takes the whole
+ * queue, so the batch grows with the load: one request on an idle server is
+ * hashed at once, and under load everything that arrived while the previous
+ * batch was hashed goes into the next one.
+ */
+void Md5Server::dispatch_loop() {
+    std::vector<Md5Request*> batch;
+    std::vector<const uint8_t*> payloads;
+    std::vector<size_t> lengths;
+    std::vector<Md5Digest> digests;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_changed.wait(lock, [&] { return !queue.empty() || stopping; });
+            if (queue.empty()) {
+                return;
+            }
+            batch.swap(queue);
+        }
+        payloads.resize(batch.size());
+        lengths.resize(batch.size());
+        digests.resize(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            payloads[i] = batch[i]->payload;
+            lengths[i] = batch[i]->length;
+        }
+        if (hmac != nullptr) {
+            hmac->mac_batch(payloads.data(), lengths.data(), batch.size(), digests.data());
+        } else {
+            md5_batch(payloads.data(), lengths.data(), batch.size(), digests.data());
+        }
+        ++batches;
+        batched += batch.size();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i]->ok = true;
+            batch[i]->digest = digests[i];
+            complete(*batch[i]);
+        }
+        batch.clear();
+    }
+}
+
+/*
+ * Return whether the canonical path is under one of the roots.
+ */
+bool Md5Server::under_roots(const std::filesystem::path& path) const {
+    for (const std::filesystem::path& root : file_roots) {
+        if (std::mismatch(root.begin(), root.end(), path.begin(), path.end()).first
+            == root.end()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Open the file of a file request for hashing and return its descriptor, or
+ * -1 with the reason in error. The path is resolved, following every symbolic
+ * link, and must be under one of the roots; a path that does not exist and a
+ * path outside the roots get the same answer, so a client cannot probe for
+ * files elsewhere. The resolved path is then opened once, without following a
+ * symbolic link swapped in since and without blocking on a FIFO, and the file
+ * that was opened must be a regular file. On Linux, the path of the open file
+ * is checked against the roots again, so a directory swapped for a link on the
+ * way cannot lead outside them either. The caller hashes this descriptor, never
+ * the path.
+ */
+int Md5Server::open_file(const std::string& path, std::string& error) const {
+    std::error_code code;
+    std::filesystem::path canonical = std::filesystem::canonical(path, code);
+    if (code || !under_roots(canonical)) {
+        error = "No such file under the served roots";
+        return -1;
+    }
+    int fd = open(canonical.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        error = "No such file under the served roots";
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        error = "Not a regular file";
+        return -1;
+    }
+#ifdef __linux__
+    std::filesystem::path opened = std::filesystem::read_symlink(
+        "/proc/self/fd/" + std::to_string(fd), code);
+    if (code || !under_roots(opened)) {
+        close(fd);
+        error = "No such file under the served roots";
+        return -1;
+    }
+#endif
+    return fd;
+}
+
+/*
+ * Start a request: queue a message for the dispatcher, hand a file to the
+ * thread pool, or answer a counters or unknown request at once. File requests
+ * are refused unless the server was given roots to serve files from.
+ */
+void Md5Server::submit(Md5Request& request) {
+    ++requests;
+    if (request.type == 'M' || request.type == 'F') {
+        md5_store_max(max_queue_depth, ++queue_depth);
+    }
+    if (request.type == 'M') {
+        ++messages;
+        bytes += request.length;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            queue.push_back(&request);
+        }
+        queue_changed.notify_one();
+    } else if (request.type == 'F') {
+        ++files;
+        pool.submit([this, &request] {
+            try {
+                int fd = -1;
+                if (file_roots.empty()) {
+                    request.ok = false;
+                    request.text = "File requests are disabled";
+                } else if ((fd = open_file(std::string(
+                        reinterpret_cast<const char*>(request.payload), request.length),
+                        request.text)) < 0) {
+                    request.ok = false;
+                } else {
+                    MappedFile file(fd);
+                    request.digest = hash_file(file);
+                    request.ok = true;
+                }
+            } catch (const std::exception& e) {
+                request.ok = false;
+                request.text = e.what();
+            }
+            complete(request);
+        });
+    } else if (request.type == 'S') {
+        request.ok = true;
+        request.text = counters();
+        complete(request);
+    } else {
+        request.ok = false;
+        request.text = "Unknown request type";
+        complete(request);
+    }
+}
+
+/*
+ * Record the latency of a finished request and wake its connection if it was
+ * the last of its round.
+ */
+void Md5Server::complete(Md5Request& request) {
+    if (request.type == 'M' || request.type == 'F') {
+        --queue_depth;
+    }
+    if (!request.ok) {
+        ++errors;
+    }
+    uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - request.received).count();
+    latency_total += latency;
+    md5_store_max(latency_max, latency);
+    ++completed;
+    Md5Round& round = *request.round;
+    std::lock_guard<std::mutex> lock(round.mutex);
+    if (--round.remaining == 0) {
+        round.done.notify_one();
+    }
+}
+
+/*
+ * Return the counters as "name value" lines. Latencies are measured from when
+ * a request was read to when its result was ready, in microseconds, and the
+ * mean is over the requests that have completed.
+ */
+std::string Md5Server::counters() const {
+    uint64_t finished = completed.load();
+    std::ostringstream text;
+    text << "requests " << requests << "\n"
+        << "completed " << finished << "\n"
+        << "messages " << messages << "\n"
+        << "files " << files << "\n"
+        << "errors " << errors << "\n"
+        << "bytes " << bytes << "\n"
+        << "batches " << batches << "\n"
+        << "mean_batch " << (batches > 0 ? (double) batched / batches : 0.0) << "\n"
+        << "queue_depth " << queue_depth << "\n"
+        << "max_queue_depth " << max_queue_depth << "\n"
+        << "latency_mean_us " << (finished > 0 ? latency_total / 1e3 / finished : 0.0) << "\n"
+        << "latency_max_us " << latency_max / 1e3 << "\n"
+        << "connections " << connections << "\n"
+        << "connections_total " << connections_total << "\n"
+        << "connections_rejected " << connections_rejected << "\n";
+    return text.str();
+}
+
+/*
+ * Append a response frame to out.
+ */
+static void md5_append_frame(std::string& out, char type, const void* payload, size_t length) {
+    out += type;
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>((length >> (i * 8)) & 0xff);
+    }
+    out.append(static_cast<const char*>(payload), length);
+}
+
+/*
+ * Send all of data, retrying partial sends. Returns false if the connection
+ * is gone.
+ */
+static bool md5_send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t count = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        sent += count;
+    }
+    return true;
+}
+
+/*
+ * Count a new connection, or return false if md5_server_max_connections are
+ * already open and the connection must be turned away.
+ */
+bool Md5Server::admit() {
+    if (connections.fetch_add(1) >= md5_server_max_connections) {
+        --connections;
+        ++connections_rejected;
+        return false;
+    }
+    ++connections_total;
+    return true;
+}
+
+/*
+ * Forget a connection counted by admit() once it is closed.
+ */
+void Md5Server::release() {
+    --connections;
+}
+
+/*
+ * Serve one connection, admitted with admit(), until the client closes it. The receive buffer grows
+ * to hold the largest frame seen, and a frame with a payload larger than
+ * md5_server_max_payload is answered with an error and closes the connection.
+ * Once the large frames have been answered, the buffer shrinks back, so an
+ * idle connection holds only its initial 64 KiB.
+ */
+void Md5Server::handle_connection(int fd) {
+    constexpr size_t initial_size = 1 << 16;
+    std::vector<uint8_t> buffer(initial_size);
+    size_t filled = 0;
+    std::vector<Md5Request> round_requests;
+    std::string response;
+    bool open = true;
+    while (open) {
+        ssize_t count = recv(fd, buffer.data() + filled, buffer.size() - filled, 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        filled += count;
+
+        auto now = std::chrono::steady_clock::now();
+        size_t offset = 0;
+        uint32_t length = 0;
+        round_requests.clear();
+        while (filled - offset >= 5) {
+            length = 0;
+            for (int i = 0; i < 4; ++i) {
+                length |= (uint32_t) buffer[offset + 1 + i] << (i * 8);
+            }
+            if (length > md5_server_max_payload) {
+                open = false;
+                break;
+            }
+            if (filled - offset - 5 < length) {
+                break;
+            }
+            round_requests.push_back({buffer[offset], &buffer[offset + 5], length, now,
+                nullptr, false, Md5Digest{}, std::string()});
+            offset += 5 + length;
+        }
+
+        Md5Round round;
+        round.remaining = round_requests.size();
+        for (Md5Request& request : round_requests) {
+            request.round = &round;
+            submit(request);
+        }
+        {
+            std::unique_lock<std::mutex> lock(round.mutex);
+            round.done.wait(lock, [&] { return round.remaining == 0; });
+        }
+
+        response.clear();
+        for (const Md5Request& request : round_requests) {
+            if (!request.ok) {
+                md5_append_frame(response, 'E', request.text.data(), request.text.size());
+            } else if (request.type == 'S') {
+                md5_append_frame(response, 'K', request.text.data(), request.text.size());
+            } else {
+                md5_append_frame(response, 'K', request.digest.data(), 16);
+            }
+        }
+        if (!open) {
+            static const char message[] = "Request too large";
+            md5_append_frame(response, 'E', message, sizeof(message) - 1);
+            ++errors;
+        }
+        if (!md5_send_all(fd, response)) {
+            break;
+        }
+
+        std::memmove(buffer.data(), buffer.data() + offset, filled - offset);
+        filled -= offset;
+        if (filled >= 5 && length + 5u > buffer.size()) {
+            buffer.resize(length + 5u);
+        } else if (filled < 5 && buffer.size() > initial_size) {
+            buffer.resize(initial_size);
+            buffer.shrink_to_fit();
+        }
+    }
+    close(fd);
+    release();
+}
+
+/*
+ * Return whether the socket at the Unix address was left behind by a server
+ * that is gone: connecting to it is refused. A socket a live server is
+ * listening on accepts the connection.
+ */
+static bool md5_socket_is_stale(const sockaddr_un& unix_address) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    bool refused = connect(fd, reinterpret_cast<const sockaddr*>(&unix_address),
+        sizeof(unix_address)) < 0 && errno == ECONNREFUSED;
+    close(fd);
+    return refused;
+}
+
+/*
+ * Open a socket listening on address, which is unix:<path> or
+ * tcp:<host>:<port>. An empty host listens on the loopback interface only;
+ * listening on every interface takes an explicit host such as 0.0.0.0. A
+ * stale Unix socket left at the path by an earlier server is replaced, but
+ * anything else at the path, including the socket of a live server, is left
+ * alone and the address is reported as in use.
+ */
+static int md5_listen(const std::string& address) {
+    if (address.compare(0, 5, "unix:") == 0) {
+        std::string path = address.substr(5);
+        sockaddr_un unix_address = {};
+        unix_address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(unix_address.sun_path)) {
+            throw std::runtime_error("Invalid Unix socket path: " + path);
+        }
+        std::memcpy(unix_address.sun_path, path.data(), path.size());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("Unable to create socket: ")
+                + std::strerror(errno));
+        }
+        struct stat info;
+        if (lstat(path.c_str(), &info) == 0) {
+            if (!S_ISSOCK(info.st_mode) || !md5_socket_is_stale(unix_address)) {
+                close(fd);
+                throw std::runtime_error("Unable to listen on " + address + ": address in use");
+            }
+            unlink(path.c_str());
+        }
+        if (bind(fd, reinterpret_cast<sockaddr*>(&unix_address), sizeof(unix_address)) < 0
+            || listen(fd, SOMAXCONN) < 0) {
+            int error = errno;
+            close(fd);
+            throw std::runtime_error("Unable to listen on " + address + ": "
+                + std::strerror(error));
+        }
+        return fd;
+    }
+    size_t colon = address.rfind(':');
+    if (address.compare(0, 4, "tcp:") != 0 || colon < 4) {
+        throw std::runtime_error("Invalid daemon address: " + address
+            + " (use unix:<path> or tcp:<host>:<port>)");
+    }
+    std::string host = address.substr(4, colon - 4), port = address.substr(colon + 1);
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* addresses = nullptr;
+    int status = getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints,
+        &addresses);
+    if (status != 0) {
+        throw std::runtime_error("Unable to resolve " + address + ": " + gai_strerror(status));
+    }
+    int fd = -1;
+    for (addrinfo* candidate = addresses; candidate != nullptr; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, candidate->ai_addr, candidate->ai_addrlen) == 0
+            && listen(fd, SOMAXCONN) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to listen on " + address);
+    }
+    return fd;
+}
+
+/*
+ * Listen on address and serve clients until the process is killed. Regular
+ * files under file_roots are opened once and hashed by passing the open file
+ * to hash_file, on thread_count threads; with no roots, file requests are
+ * refused. Messages are hashed with HMAC-MD5 if hmac is not
+ * null. Returns 1 if the server cannot start.
+ */
+int md5_serve(const std::string& address, size_t thread_count, const Md5Hmac* hmac,
+    const std::function<Md5Digest(const MappedFile&)>& hash_file,
+    const std::vector<std::string>& file_roots) {
+    signal(SIGPIPE, SIG_IGN);
+    std::vector<std::filesystem::path> roots;
+    for (const std::string& root : file_roots) {
+        std::error_code error;
+        std::filesystem::path canonical = std::filesystem::canonical(root, error);
+        if (error || !std::filesystem::is_directory(canonical, error)) {
+            std::cerr << "Error: Not a directory: " << root << std::endl;
+            return 1;
+        }
+        roots.push_back(canonical);
+    }
+    int listen_fd;
+    try {
+        listen_fd = md5_listen(address);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    // The connection threads are detached, so the server is never destroyed.
+    Md5Server* server = new Md5Server(thread_count, hmac, hash_file, roots);
+    std::cerr << "daemon: listening on " << address << std::endl;
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                std::cerr << "Error: accept failed: " << std::strerror(errno) << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (!server->admit()) {
+            std::string response;
+            static const char message[] = "Too many connections";
+            md5_append_frame(response, 'E', message, sizeof(message) - 1);
+            md5_send_all(fd, response);
+            close(fd);
+            continue;
+        }
+        try {
+            std::thread([server, fd] { server->handle_connection(fd); }).detach();
+        } catch (const std::system_error& e) {
+            std::cerr << "Error: Unable to start a connection thread: " << e.what() << std::endl;
+            close(fd);
+            server->release();
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * md5_server.h
+ *
+ * The hash server behind --daemon: a long-running process that hashes messages
+ * and files for clients over a Unix or TCP socket, so a service pays for
+ * process startup and a cold cache once rather than once per hash.
+ *
+ */
+
+#pragma once
+
+#include "libmd5.h"
+#include "../io.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * Every request and response is a frame: a one-byte type, the length of the
+ * payload as a 32-bit little-endian integer, and the payload. The requests are
+ *
+ *   'M'  hash the payload
+ *   'F'  hash the file whose path is the payload, which must resolve to a
+ *        regular file under one of the roots the server was started with
+ *   'S'  report the server counters; the payload is ignored
+ *
+ * and each is answered, in the order the requests were sent, by a 'K' frame
+ * with the 16-byte hash (or the counters as "name value" lines), or by an 'E'
+ * frame with an error message. A client may send any number of requests before
+ * reading the responses.
+ */
+inline constexpr uint32_t md5_server_max_payload = 64 << 20;
+
+/*
+ * The number of connections served at once. Each has a thread and a receive
+ * buffer that can grow to a frame of md5_server_max_payload bytes, so this
+ * bounds the memory and threads a set of clients can tie up. A connection
+ * past the limit is sent an 'E' frame and closed.
+ */
+inline constexpr size_t md5_server_max_connections = 32;
+
+int md5_serve(const std::string& address, size_t thread_count, const Md5Hmac* hmac,
+    const std::function<Md5Digest(const MappedFile&)>& hash_file,
+    const std::vector<std::string>& file_roots);
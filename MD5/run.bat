@@ -1,10 +1,43 @@
 @echo off
-echo Compiling MD5.cpp...
-g++ -Wall -Wextra -Werror MD5.cpp ../io.cpp -o MD5
-if %errorlevel% neq 0 (
-    echo Compilation failed.
-    exit /b %errorlevel%
+rem Usage: run.bat [release|debug] [native]
+rem The release profile (the default) builds with -O3 and link-time
+rem optimization; "native" adds -march=native. The Makefile offers the same
+rem profiles, plus a profile-guided build with "make pgo".
+set FLAGS=-O3 -DNDEBUG -flto=auto
+set AR=gcc-ar
+if "%1"=="debug" (
+    set FLAGS=-O0 -g
+    set AR=ar
 )
+if "%2"=="native" set FLAGS=%FLAGS% -march=native
+set CXXFLAGS=-Wall -Wextra -Werror %FLAGS%
+
+echo Compiling the MD5 library...
+g++ %CXXFLAGS% -c libmd5.cpp -o libmd5.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../io.cpp -o io.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../thread_pool.cpp -o thread_pool.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../digest_cache.cpp -o digest_cache.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../stats.cpp -o stats.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../buffer_pool.cpp -o buffer_pool.o
+if %errorlevel% neq 0 goto failed
+del /q libmd5.a 2>nul
+%AR% rcs libmd5.a libmd5.o io.o thread_pool.o digest_cache.o stats.o buffer_pool.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -shared libmd5.o io.o thread_pool.o digest_cache.o stats.o buffer_pool.o -o libmd5.dll -Wl,--out-implib,libmd5.dll.a
+if %errorlevel% neq 0 goto failed
+echo Compiling MD5.cpp...
+g++ %CXXFLAGS% MD5.cpp md5_server.cpp libmd5.a -o MD5
+if %errorlevel% neq 0 goto failed
 echo Compilation successful.
 echo Running...
-MD5 --messageFile="message.txt" --outputFile="output.txt"
\ No newline at end of file
+MD5 --messageFile="message.txt" --outputFile="output.txt"
+exit /b 0
+
+:failed
+echo Compilation failed.
+exit /b %errorlevel%
@@ -0,0 +1,36 @@
+/*
+ * SHA1.cpp
+ *
+ * Implementation of the SHA-1 hash function. This program takes a message as
+ * input and outputs the SHA-1 hash value of the message, in the same way as
+ * the MD5 program: the message can be given as a string in the command line,
+ * or as a file, and many files can be hashed at once. The hashing itself is
+ * done by the SHA-1 library declared in libsha1.h, and the command line by the
+ * driver in block_hash_cli.h, shared with the other SHA program and, for
+ * batch mode and the benchmark, with MD5; this file only ties the two
+ * together.
+ *
+ */
+
+#include "libsha1.h"
+#include "../block_hash_cli.h"
+
+/*
+ * The SHA-1 library, as seen by the command line driver.
+ */
+struct Sha1Cli {
+    typedef Sha1Context Context;
+    typedef Sha1Engine Engine;
+    static constexpr const char* program = "SHA1";
+    static constexpr const char* name = "SHA-1";
+    static size_t engine_count() { return sha1_engine_count(); }
+    static const Engine& engine_at(size_t index) { return sha1_engine_at(index); }
+    static const Engine* find_engine(const std::string& name) { return sha1_find_engine(name); }
+    static const Engine* current_engine() { return sha1_current_engine(); }
+    static void use_engine(const Engine* engine) { sha1_use_engine(engine); }
+    static bool self_test(int iterations) { return sha1_self_test(iterations); }
+};
+
+int main(int argc, char** argv) {
+    return block_hash_main<Sha1Cli>(argc, argv);
+}
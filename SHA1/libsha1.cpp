@@ -0,0 +1,415 @@
+/*
+ * libsha1.cpp
+ *
+ * The SHA-1 library, as specified in FIPS 180-4: a portable block function,
+ * block functions using the x86 SHA extensions and the ARMv8 cryptography
+ * extensions, the choice between them, and the interfaces declared in
+ * libsha1.h. The command line program in SHA1.cpp is a thin wrapper around it.
+ *
+ */
+
+#include "libsha1.h"
+#include "../block_hash_check.h"
+#include <iostream>
+#include <random>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA1_X86 1
+#include <x86intrin.h>
+#elif defined(__aarch64__)
+#define SHA1_ARM 1
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#endif
+#endif
+
+/*
+ * The round constants, one for each group of 20 rounds.
+ */
+static constexpr uint32_t K[4] = {0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6};
+
+static uint32_t sha1_rotate(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+/*
+ * Load the 4 bytes at the given position as a big-endian 32-bit integer.
+ */
+static uint32_t sha1_load_big_endian(const uint8_t* bytes) {
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16)
+        | ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3];
+}
+
+/*
+ * Process count consecutive 64-byte blocks with the portable block function.
+ * The message schedule is kept as a rolling window of 16 words.
+ */
+static void sha1_process_blocks_scalar(uint32_t state[5], const uint8_t* data,
+    size_t count) {
+    for (; count > 0; --count, data += 64) {
+        uint32_t w[16];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = sha1_load_big_endian(data + i * 4);
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int i = 0; i < 80; ++i) {
+            if (i >= 16) {
+                w[i % 16] = sha1_rotate(w[(i - 3) % 16] ^ w[(i - 8) % 16]
+                    ^ w[(i - 14) % 16] ^ w[i % 16], 1);
+            }
+            uint32_t f;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+            } else if (i < 40 || i >= 60) {
+                f = b ^ c ^ d;
+            } else {
+                f = (b & c) | (b & d) | (c & d);
+            }
+            uint32_t temp = sha1_rotate(a, 5) + f + e + K[i / 20] + w[i % 16];
+            e = d;
+            d = c;
+            c = sha1_rotate(b, 30);
+            b = a;
+            a = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#ifdef SHA1_X86
+/*
+ * Four rounds with the x86 SHA extensions. sha1rnds4 does four rounds on ABCD,
+ * taking E already added to the first message word; sha1nexte derives the
+ * next E from the ABCD of four rounds earlier. From the fifth group on, the
+ * four message words of the group are computed from the previous sixteen with
+ * sha1msg1 and sha1msg2, in place of the oldest four.
+ */
+template <int i>
+static inline __attribute__((target("sha,sse4.1"), always_inline)) void sha1_ni_rounds(
+    __m128i& abcd, __m128i& e, __m128i message[4]) {
+    if (i >= 4) {
+        message[i % 4] = _mm_sha1msg2_epu32(_mm_xor_si128(
+            _mm_sha1msg1_epu32(message[i % 4], message[(i + 1) % 4]),
+            message[(i + 2) % 4]), message[(i + 3) % 4]);
+    }
+    __m128i words = i == 0 ? _mm_add_epi32(e, message[0])
+        : _mm_sha1nexte_epu32(e, message[i % 4]);
+    e = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, words, i / 5);
+}
+
+template <int... i>
+static inline __attribute__((target("sha,sse4.1"), always_inline)) void sha1_ni_all_rounds(
+    __m128i& abcd, __m128i& e, __m128i message[4], std::integer_sequence<int, i...>) {
+    (sha1_ni_rounds<i>(abcd, e, message), ...);
+}
+
+/*
+ * Process count consecutive 64-byte blocks with the x86 SHA extensions. E is
+ * kept in the top word of a vector, which is where sha1nexte expects it.
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha1_process_blocks_shani(uint32_t state[5], const uint8_t* data,
+    size_t count) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1b);
+    __m128i e = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    for (; count > 0; --count, data += 64) {
+        __m128i saved_abcd = abcd, saved_e = e;
+        __m128i message[4];
+        for (int j = 0; j < 4; ++j) {
+            message[j] = _mm_shuffle_epi8(_mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data + j * 16)), byte_swap);
+        }
+        sha1_ni_all_rounds(abcd, e, message, std::make_integer_sequence<int, 20>());
+        e = _mm_sha1nexte_epu32(e, saved_e);
+        abcd = _mm_add_epi32(abcd, saved_abcd);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e, 3));
+}
+
+static bool sha1_shani_supported() {
+    return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#ifdef SHA1_ARM
+#ifdef __clang__
+#define SHA1_ARM_TARGET __attribute__((target("sha2")))
+#else
+#define SHA1_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+
+/*
+ * Process count consecutive 64-byte blocks with the ARMv8 cryptography
+ * extensions. Each of sha1c, sha1p and sha1m does four rounds with one of the
+ * three round functions, sha1h rotates A into the next E, and sha1su0 and
+ * sha1su1 compute the next four message words.
+ */
+SHA1_ARM_TARGET
+static void sha1_process_blocks_armv8(uint32_t state[5], const uint8_t* data,
+    size_t count) {
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e = state[4];
+    for (; count > 0; --count, data += 64) {
+        uint32x4_t saved_abcd = abcd;
+        uint32_t saved_e = e;
+        uint32x4_t message[4];
+        for (int j = 0; j < 4; ++j) {
+            message[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + j * 16)));
+        }
+        for (int i = 0; i < 20; ++i) {
+            uint32x4_t words = vaddq_u32(message[i % 4], vdupq_n_u32(K[i / 5]));
+            uint32_t next_e = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+            if (i < 5) {
+                abcd = vsha1cq_u32(abcd, e, words);
+            } else if (i < 10 || i >= 15) {
+                abcd = vsha1pq_u32(abcd, e, words);
+            } else {
+                abcd = vsha1mq_u32(abcd, e, words);
+            }
+            e = next_e;
+            if (i < 16) {
+                message[i % 4] = vsha1su1q_u32(vsha1su0q_u32(message[i % 4],
+                    message[(i + 1) % 4], message[(i + 2) % 4]), message[(i + 3) % 4]);
+            }
+        }
+        abcd = vaddq_u32(abcd, saved_abcd);
+        e += saved_e;
+    }
+    vst1q_u32(state, abcd);
+    state[4] = e;
+}
+
+/*
+ * The SHA-1 instructions are optional in ARMv8. Linux reports them in the
+ * auxiliary vector; Apple processors all have them; elsewhere they are only
+ * used if the compiler was told they are available.
+ */
+static bool sha1_armv8_supported() {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & (1 << 5)) != 0;
+#elif defined(__APPLE__) || defined(__ARM_FEATURE_SHA2)
+    return true;
+#else
+    return false;
+#endif
+}
+#endif
+
+static bool sha1_always_supported() {
+    return true;
+}
+
+/*
+ * The table of engines, ordered from slowest to fastest.
+ */
+static const Sha1Engine sha1_engines[] = {
+    {"scalar", sha1_always_supported, sha1_process_blocks_scalar},
+#ifdef SHA1_X86
+    {"shani", sha1_shani_supported, sha1_process_blocks_shani},
+#endif
+#ifdef SHA1_ARM
+    {"armv8", sha1_armv8_supported, sha1_process_blocks_armv8},
+#endif
+};
+
+/*
+ * Return the fastest engine supported by this processor.
+ */
+static const Sha1Engine* sha1_best_engine() {
+    const Sha1Engine* best = &sha1_engines[0];
+    for (const Sha1Engine& engine : sha1_engines) {
+        if (engine.supported()) {
+            best = &engine;
+        }
+    }
+    return best;
+}
+
+/*
+ * Return the engine with the given name, or nullptr if there is no such engine
+ * or it is not supported by this processor.
+ */
+const Sha1Engine* sha1_find_engine(const std::string& name) {
+    for (const Sha1Engine& engine : sha1_engines) {
+        if (name == engine.name && engine.supported()) {
+            return &engine;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * The engine used for all hashing. As with MD5, the SHA1_ENGINE environment
+ * variable pins a specific engine, and otherwise the fastest one supported by
+ * the processor is used.
+ */
+static const Sha1Engine* sha1_engine = [] {
+    const char* name = std::getenv("SHA1_ENGINE");
+    const Sha1Engine* engine = name ? sha1_find_engine(name) : nullptr;
+    return engine ? engine : sha1_best_engine();
+}();
+
+size_t sha1_engine_count() {
+    return sizeof(sha1_engines) / sizeof(sha1_engines[0]);
+}
+
+const Sha1Engine& sha1_engine_at(size_t index) {
+    return sha1_engines[index];
+}
+
+const Sha1Engine* sha1_current_engine() {
+    return sha1_engine;
+}
+
+/*
+ * Use the given engine for all hashing from now on. The engine must be
+ * supported by this processor, and this should be called before any hashing
+ * starts.
+ */
+void sha1_use_engine(const Sha1Engine* engine) {
+    sha1_engine = engine;
+}
+
+/*
+ * Process count consecutive 64-byte blocks with the current engine. This is
+ * the block function used by Sha1Context.
+ */
+void sha1_process_blocks(uint32_t state[5], const uint8_t* data, size_t count) {
+    if (count > 0) {
+        sha1_engine->process_blocks(state, data, count);
+    }
+}
+
+/*
+ * Hash a whole message held in memory and return the 20-byte hash.
+ */
+Sha1Context::Digest sha1_hash(const uint8_t* data, size_t length) {
+    Sha1Context context;
+    context.update(data, length);
+    return context.finalize();
+}
+
+/*
+ * Check the test vectors from FIPS 180-4 with every supported engine, check
+ * that every engine gives the same state as the scalar block function for
+ * random blocks processed from random starting states, and check the
+ * streaming and padding of the context on every engine around the padding
+ * boundaries and for random messages in random pieces (see
+ * block_hash_check_streaming). Returns true if every check passes.
+ */
+bool sha1_self_test(int iterations) {
+    static const char* const vectors[][2] = {
+        {"", "da39a3ee5e6b4b0d3255bfef95601890afd80709"},
+        {"abc", "a9993e364706816aba3e25717850c26c9cd0d89d"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            "84983e441c3bd26ebaae4aa1f95129e5e54670f1"},
+    };
+    const Sha1Engine* selected = sha1_engine;
+    bool passed = true;
+    for (const Sha1Engine& engine : sha1_engines) {
+        if (!engine.supported()) {
+            continue;
+        }
+        sha1_engine = &engine;
+        for (const auto& vector : vectors) {
+            std::string message = vector[0];
+            Sha1Context::Digest digest = sha1_hash(
+                reinterpret_cast<const uint8_t*>(message.data()), message.size());
+            static const char hex[] = "0123456789abcdef";
+            std::string text;
+            for (uint8_t byte : digest) {
+                text += hex[byte >> 4];
+                text += hex[byte & 15];
+            }
+            if (text != vector[1]) {
+                std::cerr << "Error: " << engine.name << " engine gives " << text
+                    << " for \"" << message << "\"" << std::endl;
+                passed = false;
+            }
+        }
+    }
+    sha1_engine = selected;
+
+    std::mt19937 rng(12345);
+    for (int iteration = 0; passed && iteration < iterations; ++iteration) {
+        uint8_t blocks[64 * 3];
+        for (uint8_t& byte : blocks) {
+            byte = rng() & 0xff;
+        }
+        uint32_t initial[5], expected[5];
+        for (uint32_t& word : initial) {
+            word = rng();
+        }
+        std::copy(initial, initial + 5, expected);
+        size_t count = 1 + rng() % 3;
+        sha1_process_blocks_scalar(expected, blocks, count);
+        for (const Sha1Engine& engine : sha1_engines) {
+            if (!engine.supported()) {
+                continue;
+            }
+            uint32_t actual[5];
+            std::copy(initial, initial + 5, actual);
+            engine.process_blocks(actual, blocks, count);
+            if (!std::equal(expected, expected + 5, actual)) {
+                std::cerr << "Error: " << engine.name << " engine mismatch in iteration "
+                    << iteration << std::endl;
+                passed = false;
+            }
+        }
+    }
+    return passed && block_hash_check_streaming<Sha1>(sha1_engines, std::size(sha1_engines),
+        sha1_engine, sha1_process_blocks_scalar, "SHA-1", iterations, rng);
+}
+
+/*
+ * The C interface is a thin layer over the C++ one, as in libmd5.cpp.
+ */
+struct sha1_context {
+    Sha1Context context;
+};
+
+sha1_context* sha1_context_new(void) {
+    return new (std::nothrow) sha1_context();
+}
+
+void sha1_context_update(sha1_context* context, const void* data, size_t length) {
+    context->context.update(static_cast<const uint8_t*>(data), length);
+}
+
+void sha1_context_final(sha1_context* context, uint8_t digest[20]) {
+    context->context.finalize(digest);
+}
+
+void sha1_context_free(sha1_context* context) {
+    delete context;
+}
+
+void sha1_digest(const void* data, size_t length, uint8_t digest[20]) {
+    Sha1Context context;
+    context.update(static_cast<const uint8_t*>(data), length);
+    context.finalize(digest);
+}
+
+int sha1_set_engine(const char* name) {
+    const Sha1Engine* engine = sha1_find_engine(name);
+    if (engine == nullptr) {
+        return 0;
+    }
+    sha1_use_engine(engine);
+    return 1;
+}
+
+const char* sha1_engine_name(void) {
+    return sha1_engine->name;
+}
@@ -0,0 +1,80 @@
+/*
+ * libsha1.h
+ *
+ * The public interface of the SHA-1 library: one-shot and streaming hashing,
+ * and the choice of engine. As in libmd5.h, the C++ interface is followed by a
+ * plain C interface with the same functionality.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+
+#include "../block_hash.h"
+#include <string>
+
+/*
+ * A SHA-1 engine processes consecutive 64-byte blocks of a single message.
+ * The engines differ only in the instructions they use: the portable scalar
+ * code, the x86 SHA extensions, or the ARMv8 cryptography extensions.
+ */
+struct Sha1Engine {
+    const char* name;
+    bool (*supported)();
+    void (*process_blocks)(uint32_t state[5], const uint8_t* data, size_t count);
+};
+
+size_t sha1_engine_count();
+const Sha1Engine& sha1_engine_at(size_t index);
+const Sha1Engine* sha1_find_engine(const std::string& name);
+const Sha1Engine* sha1_current_engine();
+void sha1_use_engine(const Sha1Engine* engine);
+void sha1_process_blocks(uint32_t state[5], const uint8_t* data, size_t count);
+
+/*
+ * The parameters of SHA-1 for BlockHashContext.
+ */
+struct Sha1 {
+    static constexpr size_t state_words = 5;
+    static constexpr size_t digest_size = 20;
+    static constexpr bool big_endian = true;
+    static constexpr uint32_t initial_state[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+    };
+    static void process_blocks(uint32_t state[5], const uint8_t* data, size_t count) {
+        sha1_process_blocks(state, data, count);
+    }
+};
+
+using Sha1Context = BlockHashContext<Sha1>;
+
+Sha1Context::Digest sha1_hash(const uint8_t* data, size_t length);
+bool sha1_self_test(int iterations);
+
+extern "C" {
+#endif
+
+/*
+ * The C interface. A context is created with sha1_context_new, fed with
+ * sha1_context_update, and sha1_context_final writes the 20-byte hash and
+ * resets the context for reuse. sha1_set_engine returns 0 if the named
+ * engine does not exist or is not supported by this processor, leaving the
+ * engine unchanged.
+ */
+typedef struct sha1_context sha1_context;
+
+sha1_context* sha1_context_new(void);
+void sha1_context_update(sha1_context* context, const void* data, size_t length);
+void sha1_context_final(sha1_context* context, uint8_t digest[20]);
+void sha1_context_free(sha1_context* context);
+void sha1_digest(const void* data, size_t length, uint8_t digest[20]);
+int sha1_set_engine(const char* name);
+const char* sha1_engine_name(void);
+
+#ifdef __cplusplus
+}
+#endif
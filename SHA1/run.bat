@@ -0,0 +1,41 @@
+@echo off
+rem Usage: run.bat [release|debug] [native]
+rem The release profile (the default) builds with -O3 and link-time
+rem optimization; "native" adds -march=native. The Makefile offers the same
+rem profiles, plus a profile-guided build with "make pgo".
+set FLAGS=-O3 -DNDEBUG -flto=auto
+set AR=gcc-ar
+if "%1"=="debug" (
+    set FLAGS=-O0 -g
+    set AR=ar
+)
+if "%2"=="native" set FLAGS=%FLAGS% -march=native
+set CXXFLAGS=-Wall -Wextra -Werror %FLAGS%
+
+echo Compiling the SHA-1 library...
+g++ %CXXFLAGS% -c libsha1.cpp -o libsha1.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../io.cpp -o io.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../thread_pool.cpp -o thread_pool.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../stats.cpp -o stats.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -c ../buffer_pool.cpp -o buffer_pool.o
+if %errorlevel% neq 0 goto failed
+del /q libsha1.a 2>nul
+%AR% rcs libsha1.a libsha1.o io.o thread_pool.o stats.o buffer_pool.o
+if %errorlevel% neq 0 goto failed
+g++ %CXXFLAGS% -shared libsha1.o io.o thread_pool.o stats.o buffer_pool.o -o libsha1.dll -Wl,--out-implib,libsha1.dll.a
+if %errorlevel% neq 0 goto failed
+echo Compiling SHA1.cpp...
+g++ %CXXFLAGS% SHA1.cpp libsha1.a -o SHA1
+if %errorlevel% neq 0 goto failed
+echo Compilation successful.
+echo Running...
+SHA1 --message="abc"
+exit /b 0
+
+:failed
+echo Compilation failed.
+exit /b %errorlevel%
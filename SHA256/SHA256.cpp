@@ -0,0 +1,36 @@
+/*
+ * SHA256.cpp
+ *
+ * Implementation of the SHA-256 hash function. This program takes a message as
+ * input and outputs the SHA-256 hash value of the message, in the same way as
+ * the MD5 program: the message can be given as a string in the command line,
+ * or as a file, and many files can be hashed at once. The hashing itself is
+ * done by the SHA-256 library declared in libsha256.h, and the command line by the
+ * driver in block_hash_cli.h, shared with the other SHA program and, for
+ * batch mode and the benchmark, with MD5; this file only ties the two
+ * together.
+ *
+ */
+
+#include "libsha256.h"
+#include "../block_hash_cli.h"
+
+/*
+ * The SHA-256 library, as seen by the command line driver.
+ */
+struct Sha256Cli {
+    typedef Sha256Context Context;
+    typedef Sha256Engine Engine;
+    static constexpr const char* program = "SHA256";
+    static constexpr const char* name = "SHA-256";
+    static size_t engine_count() { return sha256_engine_count(); }
+    static const Engine& engine_at(size_t index) { return sha256_engine_at(index); }
+    static const Engine* find_engine(const std::string& name) { return sha256_find_engine(name); }
+    static const Engine* current_engine() { return sha256_current_engine(); }
+    static void use_engine(const Engine* engine) { sha256_use_engine(engine); }
+    static bool self_test(int iterations) { return sha256_self_test(iterations); }
+};
+
+int main(int argc, char** argv) {
+    return block_hash_main<Sha256Cli>(argc, argv);
+}
@@ -0,0 +1,439 @@
+/*
+ * libsha256.cpp
+ *
+ * The SHA-256 library, as specified in FIPS 180-4: a portable block function,
+ * block functions using the x86 SHA extensions and the ARMv8 cryptography
+ * extensions, the choice between them, and the interfaces declared in
+ * libsha256.h. The command line program in SHA256.cpp is a thin wrapper
+ * around it.
+ *
+ */
+
+#include "libsha256.h"
+#include "../block_hash_check.h"
+#include <iostream>
+#include <random>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86 1
+#include <x86intrin.h>
+#elif defined(__aarch64__)
+#define SHA256_ARM 1
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#endif
+#endif
+
+/*
+ * The round constants: the first 32 bits of the fractional parts of the cube
+ * roots of the first 64 primes.
+ */
+alignas(16) static constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t sha256_rotate(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+/*
+ * Load the 4 bytes at the given position as a big-endian 32-bit integer.
+ */
+static uint32_t sha256_load_big_endian(const uint8_t* bytes) {
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16)
+        | ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3];
+}
+
+/*
+ * Process count consecutive 64-byte blocks with the portable block function.
+ * The message schedule is kept as a rolling window of 16 words, expanded as
+ * the rounds need it, rather than expanded to 64 words up front.
+ */
+static void sha256_process_blocks_scalar(uint32_t state[8], const uint8_t* data,
+    size_t count) {
+    for (; count > 0; --count, data += 64) {
+        uint32_t w[16];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = sha256_load_big_endian(data + i * 4);
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            if (i >= 16) {
+                uint32_t w15 = w[(i - 15) % 16], w2 = w[(i - 2) % 16];
+                uint32_t s0 = sha256_rotate(w15, 7) ^ sha256_rotate(w15, 18) ^ (w15 >> 3);
+                uint32_t s1 = sha256_rotate(w2, 17) ^ sha256_rotate(w2, 19) ^ (w2 >> 10);
+                w[i % 16] += s0 + w[(i - 7) % 16] + s1;
+            }
+            uint32_t s1 = sha256_rotate(e, 6) ^ sha256_rotate(e, 11) ^ sha256_rotate(e, 25);
+            uint32_t choice = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + choice + K[i] + w[i % 16];
+            uint32_t s0 = sha256_rotate(a, 2) ^ sha256_rotate(a, 13) ^ sha256_rotate(a, 22);
+            uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + majority;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_X86
+/*
+ * Four rounds with the x86 SHA extensions. The state is held as ABEF and CDGH,
+ * the layout sha256rnds2 works on, and each instruction does two rounds. From
+ * the fifth group on, the four message words of the group are computed from
+ * the previous sixteen with sha256msg1 and sha256msg2, in place of the oldest
+ * four.
+ */
+template <int i>
+static inline __attribute__((target("sha,sse4.1"), always_inline)) void sha256_ni_rounds(
+    __m128i& abef, __m128i& cdgh, __m128i message[4]) {
+    if (i >= 4) {
+        __m128i middle = _mm_alignr_epi8(message[(i + 3) % 4], message[(i + 2) % 4], 4);
+        message[i % 4] = _mm_sha256msg2_epu32(_mm_add_epi32(
+            _mm_sha256msg1_epu32(message[i % 4], message[(i + 1) % 4]), middle),
+            message[(i + 3) % 4]);
+    }
+    __m128i words = _mm_add_epi32(message[i % 4],
+        _mm_load_si128(reinterpret_cast<const __m128i*>(K + i * 4)));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(words, 0x0e));
+}
+
+template <int... i>
+static inline __attribute__((target("sha,sse4.1"), always_inline)) void sha256_ni_all_rounds(
+    __m128i& abef, __m128i& cdgh, __m128i message[4], std::integer_sequence<int, i...>) {
+    (sha256_ni_rounds<i>(abef, cdgh, message), ...);
+}
+
+/*
+ * Process count consecutive 64-byte blocks with the x86 SHA extensions.
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha256_process_blocks_shani(uint32_t state[8], const uint8_t* data,
+    size_t count) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i dcba = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i hgfe = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+    __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+    for (; count > 0; --count, data += 64) {
+        __m128i saved_abef = abef, saved_cdgh = cdgh;
+        __m128i message[4];
+        for (int j = 0; j < 4; ++j) {
+            message[j] = _mm_shuffle_epi8(_mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data + j * 16)), byte_swap);
+        }
+        sha256_ni_all_rounds(abef, cdgh, message, std::make_integer_sequence<int, 16>());
+        abef = _mm_add_epi32(abef, saved_abef);
+        cdgh = _mm_add_epi32(cdgh, saved_cdgh);
+    }
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(feba, dchg, 0xf0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+static bool sha256_shani_supported() {
+    return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#ifdef SHA256_ARM
+#ifdef __clang__
+#define SHA256_ARM_TARGET __attribute__((target("sha2")))
+#else
+#define SHA256_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+
+/*
+ * Process count consecutive 64-byte blocks with the ARMv8 cryptography
+ * extensions. sha256h and sha256h2 each update half of the state by four
+ * rounds, and sha256su0 and sha256su1 compute the next four message words.
+ */
+SHA256_ARM_TARGET
+static void sha256_process_blocks_armv8(uint32_t state[8], const uint8_t* data,
+    size_t count) {
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32x4_t efgh = vld1q_u32(state + 4);
+    for (; count > 0; --count, data += 64) {
+        uint32x4_t saved_abcd = abcd, saved_efgh = efgh;
+        uint32x4_t message[4];
+        for (int j = 0; j < 4; ++j) {
+            message[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + j * 16)));
+        }
+        for (int i = 0; i < 16; ++i) {
+            uint32x4_t words = vaddq_u32(message[i % 4], vld1q_u32(K + i * 4));
+            uint32x4_t previous_abcd = abcd;
+            abcd = vsha256hq_u32(abcd, efgh, words);
+            efgh = vsha256h2q_u32(efgh, previous_abcd, words);
+            if (i < 12) {
+                message[i % 4] = vsha256su1q_u32(
+                    vsha256su0q_u32(message[i % 4], message[(i + 1) % 4]),
+                    message[(i + 2) % 4], message[(i + 3) % 4]);
+            }
+        }
+        abcd = vaddq_u32(abcd, saved_abcd);
+        efgh = vaddq_u32(efgh, saved_efgh);
+    }
+    vst1q_u32(state, abcd);
+    vst1q_u32(state + 4, efgh);
+}
+
+/*
+ * The SHA-256 instructions are optional in ARMv8. Linux reports them in the
+ * auxiliary vector; Apple processors all have them; elsewhere they are only
+ * used if the compiler was told they are available.
+ */
+static bool sha256_armv8_supported() {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & (1 << 6)) != 0;
+#elif defined(__APPLE__) || defined(__ARM_FEATURE_SHA2)
+    return true;
+#else
+    return false;
+#endif
+}
+#endif
+
+static bool sha256_always_supported() {
+    return true;
+}
+
+/*
+ * The table of engines, ordered from slowest to fastest.
+ */
+static const Sha256Engine sha256_engines[] = {
+    {"scalar", sha256_always_supported, sha256_process_blocks_scalar},
+#ifdef SHA256_X86
+    {"shani", sha256_shani_supported, sha256_process_blocks_shani},
+#endif
+#ifdef SHA256_ARM
+    {"armv8", sha256_armv8_supported, sha256_process_blocks_armv8},
+#endif
+};
+
+/*
+ * Return the fastest engine supported by this processor.
+ */
+static const Sha256Engine* sha256_best_engine() {
+    const Sha256Engine* best = &sha256_engines[0];
+    for (const Sha256Engine& engine : sha256_engines) {
+        if (engine.supported()) {
+            best = &engine;
+        }
+    }
+    return best;
+}
+
+/*
+ * Return the engine with the given name, or nullptr if there is no such engine
+ * or it is not supported by this processor.
+ */
+const Sha256Engine* sha256_find_engine(const std::string& name) {
+    for (const Sha256Engine& engine : sha256_engines) {
+        if (name == engine.name && engine.supported()) {
+            return &engine;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * The engine used for all hashing. As with MD5, the SHA256_ENGINE environment
+ * variable pins a specific engine, and otherwise the fastest one supported by
+ * the processor is used.
+ */
+static const Sha256Engine* sha256_engine = [] {
+    const char* name = std::getenv("SHA256_ENGINE");
+    const Sha256Engine* engine = name ? sha256_find_engine(name) : nullptr;
+    return engine ? engine : sha256_best_engine();
+}();
+
+size_t sha256_engine_count() {
+    return sizeof(sha256_engines) / sizeof(sha256_engines[0]);
+}
+
+const Sha256Engine& sha256_engine_at(size_t index) {
+    return sha256_engines[index];
+}
+
+const Sha256Engine* sha256_current_engine() {
+    return sha256_engine;
+}
+
+/*
+ * Use the given engine for all hashing from now on. The engine must be
+ * supported by this processor, and this should be called before any hashing
+ * starts.
+ */
+void sha256_use_engine(const Sha256Engine* engine) {
+    sha256_engine = engine;
+}
+
+/*
+ * Process count consecutive 64-byte blocks with the current engine. This is
+ * the block function used by Sha256Context.
+ */
+void sha256_process_blocks(uint32_t state[8], const uint8_t* data, size_t count) {
+    if (count > 0) {
+        sha256_engine->process_blocks(state, data, count);
+    }
+}
+
+/*
+ * Hash a whole message held in memory and return the 32-byte hash.
+ */
+Sha256Context::Digest sha256_hash(const uint8_t* data, size_t length) {
+    Sha256Context context;
+    context.update(data, length);
+    return context.finalize();
+}
+
+/*
+ * Check the test vectors from FIPS 180-4 with every supported engine, check
+ * that every engine gives the same state as the scalar block function for
+ * random blocks processed from random starting states, and check the
+ * streaming and padding of the context on every engine around the padding
+ * boundaries and for random messages in random pieces (see
+ * block_hash_check_streaming). Returns true if every check passes.
+ */
+bool sha256_self_test(int iterations) {
+    static const char* const vectors[][2] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    };
+    const Sha256Engine* selected = sha256_engine;
+    bool passed = true;
+    for (const Sha256Engine& engine : sha256_engines) {
+        if (!engine.supported()) {
+            continue;
+        }
+        sha256_engine = &engine;
+        for (const auto& vector : vectors) {
+            std::string message = vector[0];
+            Sha256Context::Digest digest = sha256_hash(
+                reinterpret_cast<const uint8_t*>(message.data()), message.size());
+            static const char hex[] = "0123456789abcdef";
+            std::string text;
+            for (uint8_t byte : digest) {
+                text += hex[byte >> 4];
+                text += hex[byte & 15];
+            }
+            if (text != vector[1]) {
+                std::cerr << "Error: " << engine.name << " engine gives " << text
+                    << " for \"" << message << "\"" << std::endl;
+                passed = false;
+            }
+        }
+    }
+    sha256_engine = selected;
+
+    std::mt19937 rng(12345);
+    for (int iteration = 0; passed && iteration < iterations; ++iteration) {
+        uint8_t blocks[64 * 3];
+        for (uint8_t& byte : blocks) {
+            byte = rng() & 0xff;
+        }
+        uint32_t initial[8], expected[8];
+        for (uint32_t& word : initial) {
+            word = rng();
+        }
+        std::copy(initial, initial + 8, expected);
+        size_t count = 1 + rng() % 3;
+        sha256_process_blocks_scalar(expected, blocks, count);
+        for (const Sha256Engine& engine : sha256_engines) {
+            if (!engine.supported()) {
+                continue;
+            }
+            uint32_t actual[8];
+            std::copy(initial, initial + 8, actual);
+            engine.process_blocks(actual, blocks, count);
+            if (!std::equal(expected, expected + 8, actual)) {
+                std::cerr << "Error: " << engine.name << " engine mismatch in iteration "
+                    << iteration << std::endl;
+                passed = false;
+            }
+        }
+    }
+    return passed && block_hash_check_streaming<Sha256>(sha256_engines, std::size(sha256_engines),
+        sha256_engine, sha256_process_blocks_scalar, "SHA-256", iterations, rng);
+}
+
+/*
+ * The C interface is a thin layer over the C++ one, as in libmd5.cpp.
+ */
+struct sha256_context {
+    Sha256Context context;
+};
+
+sha256_context* sha256_context_new(void) {
+    return new (std::nothrow) sha256_context();
+}
+
+void sha256_context_update(sha256_context* context, const void* data, size_t length) {
+    context->context.update(static_cast<const uint8_t*>(data), length);
+}
+
+void sha256_context_final(sha256_context* context, uint8_t digest[32]) {
+    context->context.finalize(digest);
+}
+
+void sha256_context_free(sha256_context* context) {
+    delete context;
+}
+
+void sha256_digest(const void* data, size_t length, uint8_t digest[32]) {
+    Sha256Context context;
+    context.update(static_cast<const uint8_t*>(data), length);
+    context.finalize(digest);
+}
+
+int sha256_set_engine(const char* name) {
+    const Sha256Engine* engine = sha256_find_engine(name);
+    if (engine == nullptr) {
+        return 0;
+    }
+    sha256_use_engine(engine);
+    return 1;
+}
+
+const char* sha256_engine_name(void) {
+    return sha256_engine->name;
+}
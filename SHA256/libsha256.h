@@ -0,0 +1,81 @@
+/*
+ * libsha256.h
+ *
+ * The public interface of the SHA-256 library: one-shot and streaming hashing,
+ * and the choice of engine. As in libmd5.h, the C++ interface is followed by a
+ * plain C interface with the same functionality.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+
+#include "../block_hash.h"
+#include <string>
+
+/*
+ * A SHA-256 engine processes consecutive 64-byte blocks of a single message.
+ * The engines differ only in the instructions they use: the portable scalar
+ * code, the x86 SHA extensions, or the ARMv8 cryptography extensions.
+ */
+struct Sha256Engine {
+    const char* name;
+    bool (*supported)();
+    void (*process_blocks)(uint32_t state[8], const uint8_t* data, size_t count);
+};
+
+size_t sha256_engine_count();
+const Sha256Engine& sha256_engine_at(size_t index);
+const Sha256Engine* sha256_find_engine(const std::string& name);
+const Sha256Engine* sha256_current_engine();
+void sha256_use_engine(const Sha256Engine* engine);
+void sha256_process_blocks(uint32_t state[8], const uint8_t* data, size_t count);
+
+/*
+ * The parameters of SHA-256 for BlockHashContext.
+ */
+struct Sha256 {
+    static constexpr size_t state_words = 8;
+    static constexpr size_t digest_size = 32;
+    static constexpr bool big_endian = true;
+    static constexpr uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    static void process_blocks(uint32_t state[8], const uint8_t* data, size_t count) {
+        sha256_process_blocks(state, data, count);
+    }
+};
+
+using Sha256Context = BlockHashContext<Sha256>;
+
+Sha256Context::Digest sha256_hash(const uint8_t* data, size_t length);
+bool sha256_self_test(int iterations);
+
+extern "C" {
+#endif
+
+/*
+ * The C interface. A context is created with sha256_context_new, fed with
+ * sha256_context_update, and sha256_context_final writes the 32-byte hash and
+ * resets the context for reuse. sha256_set_engine returns 0 if the named
+ * engine does not exist or is not supported by this processor, leaving the
+ * engine unchanged.
+ */
+typedef struct sha256_context sha256_context;
+
+sha256_context* sha256_context_new(void);
+void sha256_context_update(sha256_context* context, const void* data, size_t length);
+void sha256_context_final(sha256_context* context, uint8_t digest[32]);
+void sha256_context_free(sha256_context* context);
+void sha256_digest(const void* data, size_t length, uint8_t digest[32]);
+int sha256_set_engine(const char* name);
+const char* sha256_engine_name(void);
+
+#ifdef __cplusplus
+}
+#endif
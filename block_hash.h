@@ -0,0 +1,147 @@
+#pragma once
+
+#include "stats.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * A streaming context for the Merkle-Damgard hashes with 64-byte blocks and a
+ * 64-bit message length: MD5, SHA-1 and SHA-256. The block function is
+ * supplied by Algorithm, which provides:
+ *
+ *   state_words    the number of 32-bit words of state
+ *   digest_size    the number of bytes in the hash
+ *   big_endian     whether the length and the state words of the hash are
+ *                  big-endian (SHA) or little-endian (MD5)
+ *   initial_state  the state before any block is processed
+ *   process_blocks a function that runs the block function over count
+ *                  consecutive 64-byte blocks
+ *
+ * At most one block is buffered, and the padding is built in finalize() rather
+ * than appended to the message, so the memory used is constant regardless of
+ * the size of the message. Md5Context adds MD5-specific operations on top of
+ * this class.
+ */
+template <typename Algorithm>
+class BlockHashContext {
+public:
+    static constexpr size_t digest_size = Algorithm::digest_size;
+    typedef std::array<uint8_t, digest_size> Digest;
+
+    BlockHashContext() {
+        reset();
+    }
+
+    /*
+     * Start from a midstate: the state after hashing a prefix of length bytes,
+     * which must be a multiple of 64. This is how HMAC skips rehashing the
+     * padded key for every message.
+     */
+    BlockHashContext(const uint32_t midstate[Algorithm::state_words], uint64_t length) {
+        std::copy(midstate, midstate + Algorithm::state_words, state);
+        buffer_length = 0;
+        total_length = length;
+    }
+
+    /*
+     * Reset the context to the initial state so it can be reused to hash
+     * another message.
+     */
+    void reset() {
+        std::copy(Algorithm::initial_state, Algorithm::initial_state + Algorithm::state_words,
+            state);
+        buffer_length = 0;
+        total_length = 0;
+    }
+
+    /*
+     * Add the next length bytes of the message to the hash. Full 64-byte blocks
+     * are processed immediately; any remaining bytes are buffered until the
+     * next call to update() or finalize().
+     */
+    void update(const uint8_t* data, size_t length) {
+        STATS_TIME(compress);
+        STATS_ADD(bytes, length);
+        STATS_ADD(blocks, (buffer_length + length) / 64);
+        total_length += length;
+        if (buffer_length > 0) {
+            size_t count = std::min(length, 64 - buffer_length);
+            std::memcpy(buffer + buffer_length, data, count);
+            buffer_length += count;
+            data += count;
+            length -= count;
+            if (buffer_length < 64) {
+                return;
+            }
+            Algorithm::process_blocks(state, buffer, 1);
+            buffer_length = 0;
+        }
+        Algorithm::process_blocks(state, data, length / 64);
+        data += length / 64 * 64;
+        length %= 64;
+        std::memcpy(buffer, data, length);
+        buffer_length = length;
+    }
+
+    /*
+     * Given the last length (< 64) bytes of a message and the total length of
+     * the message in bytes, build the final one or two blocks of the message:
+     * a 1 bit, 0 bits until 8 bytes remain in the block, and the length of the
+     * message in bits as a 64-bit integer in the byte order of Algorithm.
+     * Returns the number of blocks written to tail.
+     */
+    static int pad_tail(const uint8_t* data, size_t length, uint64_t total_length,
+        uint8_t tail[128]) {
+        int blocks = length < 56 ? 1 : 2;
+        std::memcpy(tail, data, length);
+        std::memset(tail + length, 0, blocks * 64 - length);
+        tail[length] = 0x80;
+        uint64_t bit_length = total_length * 8;
+        for (int i = 0; i < 8; ++i) {
+            tail[Algorithm::big_endian ? blocks * 64 - 1 - i : blocks * 64 - 8 + i] =
+                (bit_length >> (i * 8)) & 0xff;
+        }
+        return blocks;
+    }
+
+    /*
+     * Pad the message and write the hash to digest: the state words, each in
+     * the byte order of Algorithm. The context is reset afterwards.
+     */
+    void finalize(uint8_t digest[digest_size]) {
+        STATS_TIME(pad);
+        uint8_t tail[128];
+        int tail_blocks = pad_tail(buffer, buffer_length, total_length, tail);
+        Algorithm::process_blocks(state, tail, tail_blocks);
+        STATS_ADD(blocks, tail_blocks);
+        for (size_t i = 0; i < digest_size; ++i) {
+            int shift = Algorithm::big_endian ? 24 - (i % 4) * 8 : (i % 4) * 8;
+            digest[i] = (state[i / 4] >> shift) & 0xff;
+        }
+        reset();
+    }
+
+    /*
+     * As above, but return the hash by value, without allocating.
+     */
+    Digest finalize() {
+        Digest digest;
+        finalize(digest.data());
+        return digest;
+    }
+
+    /*
+     * Return the number of message bytes passed to update() so far.
+     */
+    uint64_t length() const {
+        return total_length;
+    }
+
+protected:
+    uint32_t state[Algorithm::state_words];
+    uint8_t buffer[64];
+    size_t buffer_length;
+    uint64_t total_length;
+};
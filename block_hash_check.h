@@ -0,0 +1,130 @@
+#pragma once
+
+#include "block_hash.h"
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Self-test checks shared by the libraries built on BlockHashContext: the
+ * streaming and padding of the context are checked against a reference that
+ * pads the whole message in memory and runs a reference block function over
+ * it, on every supported engine, for every length around the padding
+ * boundaries and for random messages, each in one update and in pieces of
+ * many sizes. MD5 has its own, more thorough, self test in libmd5.cpp; these
+ * follow its boundary and chunking checks.
+ */
+
+/*
+ * Hash the message with the given block function and the padding written out
+ * in full, as the specification describes it: the message, a 1 bit, 0 bits
+ * until 8 bytes remain in the block, and the length in bits. Nothing here is
+ * shared with BlockHashContext, so it checks the buffering and pad_tail.
+ */
+template <typename Algorithm>
+typename BlockHashContext<Algorithm>::Digest block_hash_reference(const uint8_t* data,
+    size_t length, void (*process_blocks)(uint32_t*, const uint8_t*, size_t)) {
+    std::vector<uint8_t> padded(data, data + length);
+    padded.push_back(0x80);
+    while (padded.size() % 64 != 56) {
+        padded.push_back(0);
+    }
+    uint64_t bit_length = (uint64_t) length * 8;
+    for (int i = 0; i < 8; ++i) {
+        int shift = Algorithm::big_endian ? 56 - i * 8 : i * 8;
+        padded.push_back((bit_length >> shift) & 0xff);
+    }
+    uint32_t state[Algorithm::state_words];
+    std::copy(Algorithm::initial_state, Algorithm::initial_state + Algorithm::state_words, state);
+    process_blocks(state, padded.data(), padded.size() / 64);
+    typename BlockHashContext<Algorithm>::Digest digest;
+    for (size_t i = 0; i < digest.size(); ++i) {
+        int shift = Algorithm::big_endian ? 24 - (i % 4) * 8 : (i % 4) * 8;
+        digest[i] = (state[i / 4] >> shift) & 0xff;
+    }
+    return digest;
+}
+
+/*
+ * Split length bytes into pieces to pass to update(). The pieces are the
+ * whole message, single bytes, pieces of a fixed size near the block size, or
+ * random sizes that include empty updates, so that the buffering in
+ * BlockHashContext is exercised at every offset within a block.
+ */
+inline std::vector<size_t> block_hash_random_pieces(size_t length, std::mt19937& rng) {
+    static const size_t fixed_sizes[] = {1, 3, 55, 56, 63, 64, 65, 127, 128, 129, 4096};
+    std::vector<size_t> pieces;
+    int strategy = rng() % 4;
+    size_t fixed = strategy == 1 ? 1 : fixed_sizes[rng() % std::size(fixed_sizes)];
+    for (size_t offset = 0; offset < length;) {
+        size_t piece = strategy == 0 ? length : strategy == 3 ? rng() % 200 : fixed;
+        piece = std::min(piece, length - offset);
+        pieces.push_back(piece);
+        offset += piece;
+    }
+    return pieces;
+}
+
+/*
+ * Hash a message through a context, passing it to update() in the given
+ * pieces.
+ */
+template <typename Algorithm>
+typename BlockHashContext<Algorithm>::Digest block_hash_streamed(const uint8_t* data,
+    const std::vector<size_t>& pieces) {
+    BlockHashContext<Algorithm> context;
+    for (size_t piece : pieces) {
+        context.update(data, piece);
+        data += piece;
+    }
+    return context.finalize();
+}
+
+/*
+ * Check the context on every supported engine against block_hash_reference,
+ * run with the reference block function: every length up to three blocks and
+ * a byte, which includes the lengths at which the padding changes (up to 55
+ * bytes it fits in the last block, from 56 it needs another, and at 64 the
+ * message fills a block exactly), and then iterations / 10 + 1 random
+ * messages of up to 20000 bytes. Each message is hashed in one update and in
+ * random pieces. The engine is selected by setting current, which is restored
+ * afterwards. Errors are reported on stderr with name, the name of the hash.
+ * Returns true if every check passes.
+ */
+template <typename Algorithm, typename Engine>
+bool block_hash_check_streaming(const Engine* engines, size_t engine_count,
+    const Engine*& current, void (*reference_blocks)(uint32_t*, const uint8_t*, size_t),
+    const char* name, int iterations, std::mt19937& rng) {
+    const Engine* selected = current;
+    bool passed = true;
+    size_t random_count = iterations / 10 + 1;
+    for (size_t check = 0; passed && check < 3 * 64 + 2 + random_count; ++check) {
+        size_t length = check <= 3 * 64 + 1 ? check
+            : rng() % 4 == 0 ? rng() % 20000 : rng() % 300;
+        std::vector<uint8_t> message(length);
+        for (uint8_t& byte : message) {
+            byte = rng() & 0xff;
+        }
+        auto expected = block_hash_reference<Algorithm>(message.data(), length,
+            reference_blocks);
+        for (size_t e = 0; e < engine_count; ++e) {
+            if (!engines[e].supported()) {
+                continue;
+            }
+            current = &engines[e];
+            if (block_hash_streamed<Algorithm>(message.data(),
+                    std::vector<size_t>(1, length)) != expected
+                || block_hash_streamed<Algorithm>(message.data(),
+                    block_hash_random_pieces(length, rng)) != expected) {
+                std::cerr << "Error: " << engines[e].name << " engine " << name
+                    << " mismatch in streamed updates for a " << length << "-byte message"
+                    << std::endl;
+                passed = false;
+            }
+        }
+    }
+    current = selected;
+    return passed;
+}
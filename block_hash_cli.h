@@ -0,0 +1,619 @@
+#pragma once
+
+#include "io.h"
+#include "thread_pool.h"
+#include "stats.h"
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <filesystem>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <functional>
+#include <cstdlib>
+#include <new>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * The command line driver shared by the MD5, SHA-1 and SHA-256 programs. The
+ * first part holds what every program uses: reading the list of files to hash
+ * in batch mode, hashing them in parallel with ordered output, timing and
+ * formatting benchmarks, and reporting --stats. MD5.cpp builds its own modes on
+ * these. The rest is the whole program for the SHA front ends, each of which
+ * describes its library with a Cli type, which provides:
+ *
+ *   Context          the streaming context, a BlockHashContext
+ *   Engine           the engine type of the library
+ *   program          the name of the program, such as "SHA1"
+ *   name             the name of the hash, such as "SHA-1"
+ *   engine_count, engine_at, find_engine, current_engine, use_engine
+ *                    the engine functions of the library
+ *   self_test        the self test of the library
+ *
+ * and its main() calls block_hash_main<Cli>. The message can be given as a
+ * string in the command line, or as a file, and many files can be hashed at
+ * once, in the same way as with the MD5 program.
+ *
+ * This header is included only by the file that defines main(), since it
+ * defines the allocation counting below.
+ */
+
+/*
+ * Building with -DHASH_COUNT_ALLOCATIONS=1 (make COUNT_ALLOCATIONS=1) replaces
+ * the global operator new so the benchmark can report how many allocations
+ * each operation makes. It is off by default, so the program keeps the
+ * standard allocator and no allocation pays for the count. The replacements
+ * are kept out of line so the compiler does not pair the malloc and free calls
+ * inside them with the new and delete expressions they were inlined into.
+ */
+#ifndef HASH_COUNT_ALLOCATIONS
+#define HASH_COUNT_ALLOCATIONS 0
+#endif
+
+#if HASH_COUNT_ALLOCATIONS
+static std::atomic<size_t> allocation_count(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+__attribute__((noinline)) void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+#endif
+
+/*
+ * Split text into lines at each '\n', dropping a '\r' before it, as written on
+ * Windows. The lines are views into text, so nothing is copied. A final line
+ * without a '\n' is included if it is not empty.
+ */
+inline std::vector<std::string_view> block_hash_split_lines(ByteSpan text) {
+    std::vector<std::string_view> lines;
+    std::string_view rest = text.chars();
+    while (!rest.empty()) {
+        size_t end = std::min(rest.find('\n'), rest.size());
+        std::string_view line = rest.substr(0, end);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        lines.push_back(line);
+        rest.remove_prefix(std::min(end + 1, rest.size()));
+    }
+    return lines;
+}
+
+/*
+ * Collect the paths of the files to hash in batch mode. With --directory, every
+ * regular file under the directory is included, sorted by path so the output
+ * order is stable. With --fileList, the paths are read from the given file, one
+ * per line, and kept in that order.
+ */
+inline std::vector<std::string> block_hash_batch_paths(
+    std::map<std::string, std::string>& args) {
+    std::vector<std::string> paths;
+    if (args.find("directory") != args.end()) {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(args["directory"])) {
+            if (entry.is_regular_file()) {
+                paths.push_back(entry.path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+    } else {
+        ByteArena arena;
+        for (std::string_view line :
+            block_hash_split_lines(read_file_bytes(args["fileList"], arena))) {
+            if (!line.empty()) {
+                paths.emplace_back(line);
+            }
+        }
+    }
+    return paths;
+}
+
+/*
+ * Return the indices of the given files ordered from the largest file to the
+ * smallest. Files whose size cannot be read are put last.
+ */
+inline std::vector<size_t> block_hash_largest_first(const std::vector<std::string>& paths) {
+    std::vector<std::pair<uintmax_t, size_t>> sizes;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(paths[i], error);
+        sizes.emplace_back(error ? 0 : size, i);
+    }
+    std::stable_sort(sizes.begin(), sizes.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first;
+    });
+    std::vector<size_t> order;
+    for (const auto& entry : sizes) {
+        order.push_back(entry.second);
+    }
+    return order;
+}
+
+/*
+ * Hash many files in parallel with hash_file, which takes a path and returns
+ * its digest, and write one "hash  path" line per file to the sink, in the
+ * same order as the paths and in the format read by md5sum -c and its
+ * relatives. Lines are written as soon as all the lines before them are done.
+ * Larger files are submitted first, so that the last tasks left in the pool
+ * are small ones and a few huge files do not start late and leave the other
+ * threads idle. Files that cannot be read are reported on stderr, and false is
+ * returned if there were any.
+ */
+template <typename HashFile>
+bool block_hash_files(const std::vector<std::string>& paths, size_t thread_count,
+    OutputSink& sink, HashFile hash_file) {
+    OrderedOutput output(sink, paths.size());
+    std::atomic<bool> failed(false);
+    {
+        ThreadPool pool(thread_count);
+        for (size_t index : block_hash_largest_first(paths)) {
+            pool.submit([&, index] {
+                std::string line;
+                try {
+                    auto digest = hash_file(paths[index]);
+                    line.reserve(digest.size() * 2 + 2 + paths[index].size() + 1);
+                    line.resize(digest.size() * 2);
+                    hex_encode(digest.data(), digest.size(), line.data());
+                    line += "  ";
+                    line += paths[index];
+                    line += '\n';
+                } catch (const std::exception& e) {
+                    std::cerr << std::string("Error: ") + e.what() + "\n";
+                    failed = true;
+                }
+                output.complete(index, std::move(line));
+            });
+        }
+        pool.wait();
+    }
+    output.finish();
+    return !failed;
+}
+
+/*
+ * Return a timestamp counter for measuring cycles per byte. On x86 this is the
+ * TSC, which counts reference cycles at a fixed rate; elsewhere no counter is
+ * available and 0 is returned.
+ */
+inline uint64_t block_hash_benchmark_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*
+ * The result of timing one benchmark: how many times the operation ran, how
+ * long it took in total, and how many bytes and allocations it processed. The
+ * allocations are only counted when built with HASH_COUNT_ALLOCATIONS.
+ */
+struct BlockHashBenchmarkResult {
+    size_t iterations;
+    double seconds;
+    uint64_t cycles;
+    uint64_t bytes;
+    size_t allocations;
+};
+
+/*
+ * Run an operation that processes bytes_per_run bytes repeatedly until it has
+ * run for at least min_seconds (and at least once), and return the totals. The
+ * clock is only read after batches of doubling size, so reading it does not
+ * add to the time of very short operations.
+ */
+template <typename Operation>
+BlockHashBenchmarkResult block_hash_benchmark_run(uint64_t bytes_per_run,
+    double min_seconds, Operation operation) {
+    BlockHashBenchmarkResult result = {0, 0, 0, 0, 0};
+#if HASH_COUNT_ALLOCATIONS
+    size_t allocations = allocation_count.load();
+#endif
+    uint64_t start_cycles = block_hash_benchmark_cycles();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t batch = 1; result.seconds < min_seconds; batch *= 2) {
+        for (size_t i = 0; i < batch; ++i) {
+            operation();
+        }
+        result.iterations += batch;
+        result.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    result.cycles = block_hash_benchmark_cycles() - start_cycles;
+#if HASH_COUNT_ALLOCATIONS
+    result.allocations = allocation_count.load() - allocations;
+#endif
+    result.bytes = bytes_per_run * result.iterations;
+    return result;
+}
+
+/*
+ * Format a benchmark result as a JSON object. fields holds the pairs that
+ * identify the benchmark and are written first.
+ */
+inline std::string block_hash_benchmark_json(const std::string& fields,
+    const BlockHashBenchmarkResult& result) {
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "    {" << fields << ", \"bytes\": " << result.bytes / result.iterations
+        << ", \"iterations\": " << result.iterations
+        << ", \"seconds\": " << result.seconds
+        << ", \"ns_per_op\": " << result.seconds * 1e9 / result.iterations
+        << ", \"mb_per_s\": " << result.bytes / result.seconds / 1e6
+        << ", \"cycles_per_byte\": ";
+    if (result.cycles == 0 || result.bytes == 0) {
+        json << "null";
+    } else {
+        json << (double) result.cycles / result.bytes;
+    }
+    json << ", \"allocations_per_op\": ";
+    if (HASH_COUNT_ALLOCATIONS) {
+        json << (double) result.allocations / result.iterations;
+    } else {
+        json << "null";
+    }
+    json << "}";
+    return json.str();
+}
+
+/*
+ * Return size bytes of random data for the benchmarks to hash, drawn from rng,
+ * so every run hashes the same bytes when rng has the same seed.
+ */
+inline std::vector<uint8_t> block_hash_benchmark_data(size_t size, std::mt19937& rng) {
+    std::vector<uint8_t> data(size);
+    for (uint8_t& byte : data) {
+        byte = rng() & 0xff;
+    }
+    return data;
+}
+
+/*
+ * Measure each way of reading a file, hashing the first file_size bytes of data
+ * written to a temporary file named file_name with a Context: read_file_bytes,
+ * the memory mapping, chunked reads of buffer_size bytes and the read-ahead
+ * queue, with at least 2 buffers. One result per path is added to results,
+ * identified by engine, the name of the engine in use.
+ */
+template <typename Context>
+void block_hash_benchmark_io(const std::vector<uint8_t>& data, size_t file_size,
+    double min_seconds, const char* file_name, size_t buffer_size, size_t queue_depth,
+    const std::string& engine, std::vector<std::string>& results) {
+    std::string path = (std::filesystem::temp_directory_path() / file_name).string();
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), file_size);
+        if (!file) {
+            throw std::runtime_error("Unable to write file: " + path);
+        }
+    }
+    struct IoPath {
+        const char* name;
+        std::function<void()> operation;
+    };
+    std::vector<IoPath> io_paths = {
+        {"read_file_bytes", [&] {
+            std::vector<uint8_t> bytes = read_file_bytes(path);
+            Context context;
+            context.update(bytes.data(), bytes.size());
+            context.finalize();
+        }},
+        {"mmap", [&] {
+            MappedFile file(path);
+            Context context;
+            context.update(file.data(), file.size());
+            context.finalize();
+        }},
+        {"read", [&] {
+            Context context;
+            read_file_chunks(path, buffer_size, [&](const uint8_t* bytes, size_t length) {
+                context.update(bytes, length);
+            });
+            context.finalize();
+        }},
+        {"read_ahead", [&] {
+            Context context;
+            read_file_chunks(path, buffer_size, [&](const uint8_t* bytes, size_t length) {
+                context.update(bytes, length);
+            }, std::max<size_t>(queue_depth, 2));
+            context.finalize();
+        }},
+    };
+    for (const IoPath& io_path : io_paths) {
+        BlockHashBenchmarkResult result = block_hash_benchmark_run(file_size, min_seconds,
+            io_path.operation);
+        results.push_back(block_hash_benchmark_json(std::string("\"benchmark\": \"io\", "
+            "\"path\": \"") + io_path.name + "\", \"engine\": \"" + engine + "\"", result));
+    }
+    std::filesystem::remove(path);
+}
+
+/*
+ * Return the JSON document that holds the benchmark results.
+ */
+inline std::string block_hash_benchmark_document(const std::string& profile,
+    const std::string& default_engine, const std::vector<std::string>& results) {
+    std::string json = "{\n  \"profile\": \"" + profile + "\",\n  \"default_engine\": \""
+        + default_engine + "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        json += results[i] + (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    return json + "  ]\n}\n";
+}
+
+/*
+ * If --stats was given, write the counters collected since start to standard
+ * error, so they do not mix with hashes written to standard output.
+ */
+inline void block_hash_report_stats(std::chrono::steady_clock::time_point start) {
+    if (stats_enabled()) {
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+        stats_report(std::cerr, wall.count());
+    }
+}
+
+/*
+ * The options that apply to every mode: the output file, if provided, the
+ * number of bytes read from a file or standard input at a time, set with
+ * --bufferSize, and the number of buffers read ahead on a separate I/O thread,
+ * set with --queueDepth. With a queue depth of 0 (the default), regular files
+ * are memory-mapped; a queue needs at least 2 buffers to read ahead, so 1 is
+ * refused.
+ */
+struct BlockHashOptions {
+    std::string out_file;
+    size_t read_buffer_size = 1 << 20;
+    size_t read_queue_depth = 0;
+};
+
+/*
+ * Return the usage string displayed if the user provides incorrect arguments.
+ */
+template <typename Cli>
+std::string block_hash_usage() {
+    std::string program = Cli::program, name = Cli::name;
+    return "\nUsage:\n" + program + " --message=\"...\" [--outputFile=\"...\"]\nOR\n"
+        + program + " --messageFile=\"...\" [--outputFile=\"...\"]\nOR\n"
+        + program + " --directory=\"...\" [--threads=<count>] [--outputFile=\"...\"]\nOR\n"
+        + program + " --fileList=\"...\" [--threads=<count>] [--outputFile=\"...\"]\nOR\n"
+        + program + " --selfTest=<iterations>\nOR\n"
+        + program + " --benchmark=<quick|full> [--outputFile=\"...\"]\n\n"
+        "A messageFile of \"-\" reads the message from standard input.\n"
+        "Any of the above can be combined with --engine=<name> to pin the " + name + "\n"
+        "engine (the " + program + "_ENGINE environment variable does the same), with\n"
+        "--bufferSize=<bytes> to set the size of the read buffer (default 1 MiB),\n"
+        "with --queueDepth=<buffers> to read ahead that many buffers (at least 2) on\n"
+        "a separate I/O thread, and with\n"
+        "--stats=true to report bytes, blocks and the time spent in each stage.\n";
+}
+
+/*
+ * Hash the contents of the file at the given path. Unless a read-ahead queue
+ * was requested, the file is opened once as a MappedFile: regular files are
+ * hashed in place, and other files are streamed from the descriptor already
+ * open, so a pipe is never opened twice. With a queue, the file is read in
+ * chunks with read_file_chunks.
+ */
+template <typename Cli>
+typename Cli::Context::Digest block_hash_file(const std::string& path,
+    const BlockHashOptions& options) {
+    typename Cli::Context context;
+    auto update = [&context](const uint8_t* data, size_t length) {
+        context.update(data, length);
+    };
+    if (options.read_queue_depth < 2) {
+        MappedFile file(path);
+        if (!file.is_mapped()) {
+            file.read_chunks(options.read_buffer_size, update, options.read_queue_depth);
+        }
+        for (uint64_t position = 0; position < file.size();
+            position += options.read_buffer_size) {
+            context.update(file.data() + position,
+                std::min<uint64_t>(options.read_buffer_size, file.size() - position));
+        }
+    } else {
+        read_file_chunks(path, options.read_buffer_size, update, options.read_queue_depth);
+    }
+    STATS_ADD(files, 1);
+    return context.finalize();
+}
+
+/*
+ * Measure the throughput of every supported engine hashing a single message
+ * through the context, and of each way of reading a file, and return the
+ * results as a JSON document in the same format as the MD5 benchmark. The
+ * "quick" profile covers messages from 0 bytes to 16 MiB; the "full" profile
+ * goes up to 1 GiB.
+ */
+template <typename Cli>
+std::string block_hash_benchmark(const std::string& profile, const BlockHashOptions& options) {
+    if (profile != "quick" && profile != "full") {
+        std::cerr << "Error: Unknown benchmark profile: " << profile << std::endl;
+        std::cerr << block_hash_usage<Cli>() << std::endl;
+        exit(1);
+    }
+    bool full = profile == "full";
+    double min_seconds = full ? 1.0 : 0.2;
+    std::vector<size_t> sizes = {0, 64, 1 << 10, 1 << 16, 1 << 20, 1 << 24};
+    if (full) {
+        sizes.push_back(1 << 28);
+        sizes.push_back(1 << 30);
+    }
+    std::mt19937 rng(12345);
+    std::vector<uint8_t> data = block_hash_benchmark_data(sizes.back(), rng);
+
+    std::vector<std::string> results;
+    const typename Cli::Engine* selected_engine = Cli::current_engine();
+    for (size_t e = 0; e < Cli::engine_count(); ++e) {
+        const typename Cli::Engine& engine = Cli::engine_at(e);
+        if (!engine.supported()) {
+            continue;
+        }
+        Cli::use_engine(&engine);
+        std::string name = std::string("\"engine\": \"") + engine.name + "\"";
+        for (size_t size : sizes) {
+            uint8_t digest[Cli::Context::digest_size];
+            BlockHashBenchmarkResult single = block_hash_benchmark_run(size, min_seconds, [&] {
+                typename Cli::Context context;
+                context.update(data.data(), size);
+                context.finalize(digest);
+            });
+            results.push_back(block_hash_benchmark_json("\"benchmark\": \"single\", " + name,
+                single));
+        }
+    }
+    Cli::use_engine(selected_engine);
+
+    std::string file_name = std::string(Cli::program) + "_benchmark.bin";
+    block_hash_benchmark_io<typename Cli::Context>(data, full ? (1 << 28) : (1 << 24),
+        min_seconds, file_name.c_str(), options.read_buffer_size, options.read_queue_depth,
+        Cli::current_engine()->name, results);
+    return block_hash_benchmark_document(profile, Cli::current_engine()->name, results);
+}
+
+/*
+ * Hash the message given with --message or --messageFile.
+ */
+template <typename Cli>
+typename Cli::Context::Digest block_hash_message(std::map<std::string, std::string>& args,
+    const BlockHashOptions& options) {
+    typename Cli::Context context;
+    if (args.find("message") == args.end()) {
+        if (args.find("messageFile") == args.end()) {
+            std::cerr << "Error: No message provided." << std::endl;
+            std::cerr << block_hash_usage<Cli>() << std::endl;
+            exit(1);
+        }
+        if (args["messageFile"] == "-") {
+            read_stdin_chunks(options.read_buffer_size,
+                [&context](const uint8_t* data, size_t length) {
+                    context.update(data, length);
+                }, options.read_queue_depth);
+            return context.finalize();
+        }
+        return block_hash_file<Cli>(args["messageFile"], options);
+    }
+    if (args.find("messageFile") != args.end()) {
+        std::cerr << "Error: Both message and messageFile provided." << std::endl;
+        std::cerr << block_hash_usage<Cli>() << std::endl;
+        exit(1);
+    }
+    const std::string& message = args["message"];
+    context.update(reinterpret_cast<const uint8_t*>(message.data()), message.size());
+    return context.finalize();
+}
+
+/*
+ * Parse the command line and run the requested mode. Returns the exit status.
+ */
+template <typename Cli>
+int block_hash_main(int argc, char** argv) {
+    const std::string usage = block_hash_usage<Cli>();
+    std::vector<std::string> accepted_args = {"message", "messageFile", "outputFile",
+        "selfTest", "engine", "directory", "fileList", "threads", "bufferSize",
+        "queueDepth", "benchmark", "stats"};
+    std::map<std::string, std::string> args = parse_args(argc, argv, accepted_args, usage);
+    BlockHashOptions options;
+    if (args.find("outputFile") != args.end()) {
+        options.out_file = args["outputFile"];
+    }
+    if (args.find("bufferSize") != args.end()) {
+        options.read_buffer_size = std::stoul(args["bufferSize"]);
+        if (options.read_buffer_size == 0) {
+            std::cerr << "Error: bufferSize must be positive." << std::endl;
+            exit(1);
+        }
+    }
+    if (args.find("queueDepth") != args.end()) {
+        options.read_queue_depth = std::stoul(args["queueDepth"]);
+        if (options.read_queue_depth == 1) {
+            std::cerr << "Error: queueDepth must be 0 or at least 2." << std::endl;
+            std::cerr << usage << std::endl;
+            exit(1);
+        }
+    }
+    if (args.find("engine") != args.end()) {
+        const typename Cli::Engine* engine = Cli::find_engine(args["engine"]);
+        if (engine == nullptr) {
+            std::cerr << "Error: Unsupported engine: " << args["engine"] << std::endl;
+            std::cerr << "Supported engines:";
+            for (size_t e = 0; e < Cli::engine_count(); ++e) {
+                if (Cli::engine_at(e).supported()) {
+                    std::cerr << " " << Cli::engine_at(e).name;
+                }
+            }
+            std::cerr << std::endl;
+            exit(1);
+        }
+        Cli::use_engine(engine);
+    }
+    if (args.find("selfTest") != args.end()) {
+        bool passed = Cli::self_test(std::stoi(args["selfTest"]));
+        std::cout << "self test: " << (passed ? "passed" : "FAILED") << std::endl;
+        return passed ? 0 : 1;
+    }
+
+    if (args.find("benchmark") != args.end()) {
+        std::string json = block_hash_benchmark<Cli>(args["benchmark"], options);
+        if (options.out_file.empty()) {
+            std::cout << json << std::flush;
+        } else {
+            write_file(options.out_file, json);
+        }
+        return 0;
+    }
+
+    if (args.find("stats") != args.end() && args["stats"] != "0" && args["stats"] != "false") {
+#if HASH_STATS
+        stats_enable();
+#else
+        std::cerr << "Error: This build was compiled without stats (HASH_STATS=0)." << std::endl;
+        exit(1);
+#endif
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    if (args.find("directory") != args.end() || args.find("fileList") != args.end()) {
+        if (args.find("directory") != args.end() && args.find("fileList") != args.end()) {
+            std::cerr << "Error: Both directory and fileList provided." << std::endl;
+            std::cerr << usage << std::endl;
+            exit(1);
+        }
+        size_t thread_count = 0;
+        if (args.find("threads") != args.end()) {
+            thread_count = std::stoul(args["threads"]);
+        }
+        OutputSink sink(options.out_file);
+        bool passed = block_hash_files(block_hash_batch_paths(args), thread_count, sink,
+            [&](const std::string& path) { return block_hash_file<Cli>(path, options); });
+        block_hash_report_stats(start);
+        return passed ? 0 : 1;
+    }
+
+    typename Cli::Context::Digest result_bytes = block_hash_message<Cli>(args, options);
+
+    if (options.out_file.empty()) {
+        std::cout << "hash: " << to_hex_string(result_bytes) << std::endl;
+    } else {
+        std::cout << "Writing hash to " << options.out_file << "...";
+        write_file(options.out_file, to_hex_string(result_bytes));
+        std::cout << " Done." << std::endl;
+    }
+    block_hash_report_stats(start);
+    return 0;
+}
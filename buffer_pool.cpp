@@ -0,0 +1,193 @@
+#include "buffer_pool.h"
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/*
+ * The size classes are the powers of two from 64 bytes to 256 MiB. Larger
+ * buffers are rare enough to be allocated and freed directly.
+ */
+static constexpr int min_class_shift = 6;
+static constexpr int max_class_shift = 28;
+static constexpr int class_count = max_class_shift - min_class_shift + 1;
+static constexpr size_t page_size = 4096;
+
+/*
+ * Return the size class of the smallest buffer that holds size bytes, or -1 if
+ * there is none.
+ */
+static int size_class(size_t size) {
+    int index = 0;
+    while (index < class_count && (size_t(1) << (index + min_class_shift)) < size) {
+        ++index;
+    }
+    return index < class_count ? index : -1;
+}
+
+/*
+ * Return the alignment of a buffer of the given capacity: the capacity itself,
+ * up to a page.
+ */
+static size_t buffer_alignment(size_t capacity) {
+    return std::min(capacity, page_size);
+}
+
+/*
+ * Return how many free buffers a list of the given class keeps: up to 64, as
+ * many as fit in 64 MiB. A list never holds more than that, so a buffer of a
+ * class larger than 64 MiB is freed as soon as it is released.
+ */
+static size_t free_list_limit(int index) {
+    return std::min<size_t>((size_t(64) << 20) >> (index + min_class_shift), 64);
+}
+
+/*
+ * A free list for every size class.
+ */
+struct FreeLists {
+    std::vector<uint8_t*> lists[class_count];
+};
+
+/*
+ * The shared free lists, for buffers that do not fit on a thread's lists. They
+ * are never destroyed, so buffers released while the program exits still have
+ * somewhere to go.
+ */
+static std::mutex shared_mutex;
+static FreeLists& shared_lists = *new FreeLists();
+
+/*
+ * The free lists of one thread. When the thread exits, its buffers move to
+ * the shared lists, and buffers released by destructors that run after that
+ * go straight to the shared lists.
+ */
+static thread_local bool thread_lists_destroyed = false;
+
+struct ThreadFreeLists {
+    FreeLists free;
+
+    ~ThreadFreeLists() {
+        thread_lists_destroyed = true;
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        for (int index = 0; index < class_count; ++index) {
+            for (uint8_t* buffer : free.lists[index]) {
+                std::vector<uint8_t*>& shared = shared_lists.lists[index];
+                if (shared.size() < free_list_limit(index)) {
+                    shared.push_back(buffer);
+                } else {
+                    size_t capacity = size_t(1) << (index + min_class_shift);
+                    operator delete[](buffer, std::align_val_t(buffer_alignment(capacity)));
+                }
+            }
+        }
+    }
+};
+
+static FreeLists* thread_lists() {
+    if (thread_lists_destroyed) {
+        return nullptr;
+    }
+    thread_local ThreadFreeLists lists;
+    return &lists.free;
+}
+
+/*
+ * Take a buffer of at least size bytes from the pool, or allocate one, and
+ * store its capacity.
+ */
+static uint8_t* acquire_buffer(size_t size, size_t& capacity) {
+    int index = size_class(size);
+    if (index < 0) {
+        capacity = size;
+        return static_cast<uint8_t*>(operator new[](size, std::align_val_t(page_size)));
+    }
+    capacity = size_t(1) << (index + min_class_shift);
+    if (FreeLists* free = thread_lists()) {
+        if (!free->lists[index].empty()) {
+            uint8_t* buffer = free->lists[index].back();
+            free->lists[index].pop_back();
+            return buffer;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        std::vector<uint8_t*>& shared = shared_lists.lists[index];
+        if (!shared.empty()) {
+            uint8_t* buffer = shared.back();
+            shared.pop_back();
+            return buffer;
+        }
+    }
+    return static_cast<uint8_t*>(operator new[](capacity,
+        std::align_val_t(buffer_alignment(capacity))));
+}
+
+/*
+ * Return a buffer with the given capacity to the pool, or free it if the free
+ * lists of its class are full.
+ */
+static void release_buffer(uint8_t* buffer, size_t capacity) {
+    int index = size_class(capacity);
+    if (index < 0 || (size_t(1) << (index + min_class_shift)) != capacity) {
+        operator delete[](buffer, std::align_val_t(page_size));
+        return;
+    }
+    if (FreeLists* free = thread_lists()) {
+        if (free->lists[index].size() < free_list_limit(index)) {
+            free->lists[index].push_back(buffer);
+            return;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        std::vector<uint8_t*>& shared = shared_lists.lists[index];
+        if (shared.size() < free_list_limit(index)) {
+            shared.push_back(buffer);
+            return;
+        }
+    }
+    operator delete[](buffer, std::align_val_t(buffer_alignment(capacity)));
+}
+
+/*
+ * Take a buffer of size bytes from the pool. An empty buffer has no storage.
+ */
+PooledBuffer::PooledBuffer(size_t size) : pointer(nullptr), length(size), capacity_bytes(0) {
+    if (size > 0) {
+        pointer = acquire_buffer(size, capacity_bytes);
+    }
+}
+
+PooledBuffer::~PooledBuffer() {
+    release();
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : pointer(other.pointer), length(other.length), capacity_bytes(other.capacity_bytes) {
+    other.pointer = nullptr;
+    other.length = 0;
+    other.capacity_bytes = 0;
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        std::swap(pointer, other.pointer);
+        std::swap(length, other.length);
+        std::swap(capacity_bytes, other.capacity_bytes);
+    }
+    return *this;
+}
+
+/*
+ * Give the buffer back to the pool, leaving this empty.
+ */
+void PooledBuffer::release() {
+    if (pointer != nullptr) {
+        release_buffer(pointer, capacity_bytes);
+    }
+    pointer = nullptr;
+    length = 0;
+    capacity_bytes = 0;
+}
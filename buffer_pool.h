@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * A buffer from the shared pool of aligned buffers. Sizes are rounded up to a
+ * power of two of at least 64 bytes, and every buffer is aligned to its
+ * capacity up to a page (4096 bytes), so small buffers start on a cache line
+ * and large ones on a page, as direct I/O and the SIMD loads prefer.
+ *
+ * Released buffers are kept on a free list of the thread that released them,
+ * so a thread that keeps needing buffers of the same sizes, such as a reader
+ * or a worker in the thread pool, reuses its own without taking a lock or
+ * allocating. A thread's lists are bounded; buffers beyond the bound, and those
+ * left when the thread exits, go to a shared list, and only when that is full
+ * too are they freed.
+ *
+ * A PooledBuffer owns its buffer and can be moved but not copied. Its contents
+ * are not initialized.
+ */
+class PooledBuffer {
+public:
+    PooledBuffer() : pointer(nullptr), length(0), capacity_bytes(0) {}
+    explicit PooledBuffer(size_t size);
+    ~PooledBuffer();
+
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    uint8_t* data() const { return pointer; }
+    size_t size() const { return length; }
+    size_t capacity() const { return capacity_bytes; }
+
+    void release();
+
+private:
+    uint8_t* pointer;
+    size_t length;
+    size_t capacity_bytes;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/*
+ * A read-only view of contiguous bytes that it does not own: a pointer and a
+ * length, with the interface of std::span<const uint8_t>, which needs C++20.
+ * A view converts implicitly from any contiguous container of single-byte
+ * elements with data() and size(), such as std::string, std::string_view,
+ * std::vector<uint8_t> and std::array, so the bytes of a memory-mapped file, a
+ * network buffer or an argument can be passed on without copying them.
+ */
+class ByteSpan {
+public:
+    constexpr ByteSpan() : pointer(nullptr), length(0) {}
+    constexpr ByteSpan(const uint8_t* data, size_t size) : pointer(data), length(size) {}
+    ByteSpan(const void* data, size_t size)
+        : pointer(static_cast<const uint8_t*>(data)), length(size) {}
+
+    template <typename Bytes,
+        typename = std::enable_if_t<sizeof(*std::declval<const Bytes&>().data()) == 1>>
+    ByteSpan(const Bytes& bytes) : ByteSpan(bytes.data(), bytes.size()) {}
+
+    constexpr const uint8_t* data() const { return pointer; }
+    constexpr size_t size() const { return length; }
+    constexpr bool empty() const { return length == 0; }
+    constexpr const uint8_t* begin() const { return pointer; }
+    constexpr const uint8_t* end() const { return pointer + length; }
+    constexpr uint8_t operator[](size_t index) const { return pointer[index]; }
+
+    /*
+     * Return the count bytes starting at offset, or all of the bytes from
+     * offset to the end if count is omitted. offset must not be past the end.
+     */
+    constexpr ByteSpan subspan(size_t offset, size_t count = SIZE_MAX) const {
+        return ByteSpan(pointer + offset, count < length - offset ? count : length - offset);
+    }
+
+    /*
+     * Return the same bytes viewed as characters.
+     */
+    std::string_view chars() const {
+        return std::string_view(reinterpret_cast<const char*>(pointer), length);
+    }
+
+private:
+    const uint8_t* pointer;
+    size_t length;
+};
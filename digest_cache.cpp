@@ -0,0 +1,282 @@
+#include "digest_cache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+#include <sys/stat.h>
+
+/*
+ * The cache file starts with this header: the magic, the version and the
+ * number of records. The records follow, and then the path table, which holds
+ * the paths of the records one after another. A cache of an older version is
+ * not read, so it is replaced by the next save().
+ */
+static constexpr char cache_magic[8] = {'D', 'G', 'S', 'T', 'C', 'A', 'C', 'H'};
+static constexpr uint32_t cache_version = 2;
+static constexpr size_t cache_header_size = 24;
+static constexpr size_t cache_record_size = 64;
+
+/*
+ * Read and write unsigned little-endian integers of the given number of bytes.
+ */
+static uint64_t load_le(const uint8_t* bytes, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; ++i) {
+        value |= (uint64_t) bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+static void store_le(uint8_t* bytes, uint64_t value, int size) {
+    for (int i = 0; i < size; ++i) {
+        bytes[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+/*
+ * Return the path under which a file is cached, the absolute form of its path,
+ * so the same file has the same key whatever directory the program is run
+ * from, together with the 64-bit FNV-1a hash of that path.
+ */
+static std::pair<uint64_t, std::string> cache_key(const std::string& path) {
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(path, error);
+    std::string key = error ? path : absolute.lexically_normal().string();
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    return {hash, key};
+}
+
+/*
+ * Decode and encode a record in the layout used by the cache file.
+ */
+static DigestCache::Record decode_record(const uint8_t* bytes) {
+    DigestCache::Record record;
+    record.path_hash = load_le(bytes, 8);
+    record.size = load_le(bytes + 8, 8);
+    record.mtime_ns = static_cast<int64_t>(load_le(bytes + 16, 8));
+    record.inode = load_le(bytes + 24, 8);
+    std::memcpy(record.digest, bytes + 32, 16);
+    record.path_offset = load_le(bytes + 48, 8);
+    record.path_length = static_cast<uint32_t>(load_le(bytes + 56, 4));
+    return record;
+}
+
+static void encode_record(const DigestCache::Record& record, uint8_t* bytes) {
+    store_le(bytes, record.path_hash, 8);
+    store_le(bytes + 8, record.size, 8);
+    store_le(bytes + 16, static_cast<uint64_t>(record.mtime_ns), 8);
+    store_le(bytes + 24, record.inode, 8);
+    std::memcpy(bytes + 32, record.digest, 16);
+    store_le(bytes + 48, record.path_offset, 8);
+    store_le(bytes + 56, record.path_length, 4);
+    store_le(bytes + 60, 0, 4);
+}
+
+/*
+ * Read the size, modification time and inode of a file. Returns false if the
+ * file does not exist or is not a regular file. On systems without inodes the
+ * inode is 0.
+ */
+bool read_file_metadata(const std::string& path, FileMetadata& metadata) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) {
+        return false;
+    }
+    metadata.size = std::filesystem::file_size(path, error);
+    auto mtime = std::filesystem::last_write_time(path, error);
+    if (error) {
+        return false;
+    }
+    metadata.mtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        mtime.time_since_epoch()).count();
+    metadata.inode = 0;
+#ifndef _WIN32
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    metadata.inode = info.st_ino;
+#endif
+    return true;
+}
+
+/*
+ * Open the cache stored in the given file. If the file does not exist or is not
+ * a valid cache, the cache starts out empty.
+ */
+DigestCache::DigestCache(const std::string& filename)
+    : filename(filename), records(nullptr), record_count(0), paths(nullptr), paths_size(0),
+      hit_count(0), miss_count(0) {
+    std::error_code error;
+    if (!std::filesystem::exists(filename, error)) {
+        return;
+    }
+    mapped = std::make_unique<MappedFile>(filename);
+    const uint8_t* data = mapped->data();
+    size_t size = mapped->size();
+    uint64_t count = size < cache_header_size ? 0 : load_le(data + 16, 8);
+    if (!mapped->is_mapped() || size < cache_header_size
+        || std::memcmp(data, cache_magic, 8) != 0
+        || load_le(data + 8, 4) != cache_version
+        || count > (size - cache_header_size) / cache_record_size) {
+        mapped.reset();
+        return;
+    }
+    records = data + cache_header_size;
+    record_count = count;
+    paths = reinterpret_cast<const char*>(records + count * cache_record_size);
+    paths_size = size - cache_header_size - count * cache_record_size;
+}
+
+/*
+ * Return the path of a record read from the cache file, or an empty path if
+ * the record points outside the path table.
+ */
+std::string_view DigestCache::path_on_disk(const Record& record) const {
+    if (record.path_offset > paths_size || record.path_length > paths_size - record.path_offset) {
+        return std::string_view();
+    }
+    return std::string_view(paths + record.path_offset, record.path_length);
+}
+
+/*
+ * Binary search the cache file for the first record with the hash of the
+ * given key, then check the records with that hash for the path of the key.
+ */
+bool DigestCache::find_on_disk(const Key& key, Record& record) const {
+    size_t low = 0, high = record_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        uint64_t middle_hash = load_le(records + middle * cache_record_size, 8);
+        if (middle_hash < key.first) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    for (; low < record_count && load_le(records + low * cache_record_size, 8) == key.first;
+        ++low) {
+        record = decode_record(records + low * cache_record_size);
+        if (path_on_disk(record) == key.second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Look up the digest of the file at the given path. If the cache has a digest
+ * for the path and the metadata it was stored with matches, the digest is
+ * copied to digest and true is returned.
+ */
+bool DigestCache::lookup(const std::string& path, const FileMetadata& metadata,
+    uint8_t digest[16]) {
+    Key key = cache_key(path);
+    Record record{};
+    bool found;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        auto it = pending.find(key);
+        found = it != pending.end();
+        if (found) {
+            record = it->second;
+        }
+    }
+    found = found || find_on_disk(key, record);
+    if (found && record.size == metadata.size && record.mtime_ns == metadata.mtime_ns
+        && record.inode == metadata.inode) {
+        std::memcpy(digest, record.digest, 16);
+        ++hit_count;
+        return true;
+    }
+    ++miss_count;
+    return false;
+}
+
+/*
+ * Record the digest of the file at the given path, along with the metadata the
+ * file had when it was hashed. The record is written to disk by save().
+ */
+void DigestCache::store(const std::string& path, const FileMetadata& metadata,
+    const uint8_t digest[16]) {
+    Key key = cache_key(path);
+    Record record;
+    record.path_hash = key.first;
+    record.size = metadata.size;
+    record.mtime_ns = metadata.mtime_ns;
+    record.inode = metadata.inode;
+    std::memcpy(record.digest, digest, 16);
+    record.path_offset = 0;
+    record.path_length = 0;
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending[std::move(key)] = record;
+}
+
+/*
+ * Write the new records to the cache file. The latest version of the file is
+ * read again so that records saved by other runs in the meantime are kept, the
+ * new records are merged in, and the result is written with write_file_atomic,
+ * so a concurrent run sees either the old cache or the new one, never a partial
+ * file. The merge holds a lock on a lock file next to the cache, so runs that
+ * save at the same time take turns instead of overwriting each other's records.
+ */
+void DigestCache::save() {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    if (pending.empty()) {
+        return;
+    }
+    FileLock file_lock(filename + ".lock");
+    mapped.reset();
+    records = nullptr;
+    record_count = 0;
+    paths = nullptr;
+    paths_size = 0;
+    DigestCache latest(filename);
+    std::vector<uint8_t> contents(cache_header_size);
+    std::string path_table;
+    std::memcpy(contents.data(), cache_magic, 8);
+    store_le(contents.data() + 8, cache_version, 4);
+    store_le(contents.data() + 12, 0, 4);
+    auto append = [&contents, &path_table](Record record, std::string_view path) {
+        record.path_offset = path_table.size();
+        record.path_length = static_cast<uint32_t>(path.size());
+        path_table.append(path);
+        contents.resize(contents.size() + cache_record_size);
+        encode_record(record, contents.data() + contents.size() - cache_record_size);
+    };
+    auto it = pending.begin();
+    for (size_t i = 0; i < latest.record_count; ++i) {
+        Record record = decode_record(latest.records + i * cache_record_size);
+        std::string_view path = latest.path_on_disk(record);
+        auto before = [&record, path](const Key& key) {
+            return key.first != record.path_hash ? key.first < record.path_hash
+                : std::string_view(key.second) < path;
+        };
+        for (; it != pending.end() && before(it->first); ++it) {
+            append(it->second, it->first.second);
+        }
+        if (it == pending.end() || it->first.first != record.path_hash
+            || it->first.second != path) {
+            append(record, path);
+        }
+    }
+    for (; it != pending.end(); ++it) {
+        append(it->second, it->first.second);
+    }
+    latest.mapped.reset();
+    store_le(contents.data() + 16, (contents.size() - cache_header_size) / cache_record_size, 8);
+    contents.insert(contents.end(), path_table.begin(), path_table.end());
+
+    write_file_atomic(filename, contents);
+    pending.clear();
+    mapped = std::make_unique<MappedFile>(filename);
+    records = mapped->data() + cache_header_size;
+    record_count = load_le(mapped->data() + 16, 8);
+    paths = reinterpret_cast<const char*>(records + record_count * cache_record_size);
+    paths_size = mapped->size() - cache_header_size - record_count * cache_record_size;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "io.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/*
+ * The metadata of a file that the digest cache compares to decide whether the
+ * file has changed since it was hashed.
+ */
+struct FileMetadata {
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t inode;
+};
+
+bool read_file_metadata(const std::string& path, FileMetadata& metadata);
+
+/*
+ * A persistent cache of 16-byte file digests keyed by the path, size,
+ * modification time and inode of each file. The cache file is a compact index
+ * of fixed-size records sorted by a hash of the path, followed by a table of
+ * the paths themselves. It is memory-mapped and binary searched by the hash,
+ * so opening even a very large cache costs almost nothing, and the path of a
+ * record is compared before it is used, so paths whose hashes collide never
+ * share an entry.
+ * New digests are kept in memory until save(), which merges them with the
+ * latest cache file on disk and atomically replaces it under a lock file, so
+ * concurrent runs never see a partially written cache or lose each other's
+ * records. lookup() and store() may be called from
+ * any number of threads, but not while save() is running.
+ */
+class DigestCache {
+public:
+    explicit DigestCache(const std::string& filename);
+
+    DigestCache(const DigestCache&) = delete;
+    DigestCache& operator=(const DigestCache&) = delete;
+
+    bool lookup(const std::string& path, const FileMetadata& metadata, uint8_t digest[16]);
+    void store(const std::string& path, const FileMetadata& metadata, const uint8_t digest[16]);
+    void save();
+
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+
+    /*
+     * One record of the cache file, stored in little-endian byte order. The
+     * path is not part of the record but is stored in the path table, and
+     * recorded here by its offset and length within it.
+     */
+    struct Record {
+        uint64_t path_hash;
+        uint64_t size;
+        int64_t mtime_ns;
+        uint64_t inode;
+        uint8_t digest[16];
+        uint64_t path_offset;
+        uint32_t path_length;
+    };
+
+private:
+    /*
+     * The key of a pending record: the hash and the path, in the order of
+     * the records in the cache file.
+     */
+    typedef std::pair<uint64_t, std::string> Key;
+
+    bool find_on_disk(const Key& key, Record& record) const;
+    std::string_view path_on_disk(const Record& record) const;
+
+    std::string filename;
+    std::unique_ptr<MappedFile> mapped;
+    const uint8_t* records;
+    size_t record_count;
+    const char* paths;
+    size_t paths_size;
+    std::map<Key, Record> pending;
+    std::mutex pending_mutex;
+    std::atomic<size_t> hit_count;
+    std::atomic<size_t> miss_count;
+};
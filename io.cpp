@@ -1,10 +1,33 @@
 #include "io.h"
+#include "stats.h"
+#include "buffer_pool.h"
 #include <fstream>
 #include <iostream>
-#include <sstream>
-#include <iterator>
-#include <iomanip>
 #include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <filesystem>
+#include <random>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <cstdio>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /*
  * Parse the command line arguments into a map of argument names to values.
@@ -45,22 +68,458 @@ std::map<std::string, std::string> parse_args(int argc, char** argv,
 
 /*
  * Given the path to a file on the filesystem, read the contents of the file
- * into a vector of bytes.
+ * into a vector of bytes. The file is read in large blocks rather than one
+ * character at a time, and the vector is sized from the size of the file up
+ * front rather than grown as it is read.
  */
 std::vector<uint8_t> read_file_bytes(const std::string& file_path) {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file) {
+    std::vector<uint8_t> bytes;
+    std::error_code error;
+    uintmax_t file_size = std::filesystem::file_size(file_path, error);
+    if (!error) {
+        bytes.reserve(static_cast<size_t>(file_size));
+    }
+    read_file_chunks(file_path, 1 << 16, [&bytes](const uint8_t* data, size_t length) {
+        bytes.insert(bytes.end(), data, data + length);
+    });
+    return bytes;
+}
+
+/*
+ * As above, but read the contents into a buffer from the arena and return a
+ * view of it. The buffer is sized from the size of the file, so a regular file
+ * is read without regrowing it; if the file grows while it is read, or has no
+ * size, such as a pipe, the buffer is doubled as needed.
+ */
+ByteSpan read_file_bytes(const std::string& file_path, ByteArena& arena) {
+    std::error_code error;
+    uintmax_t file_size = std::filesystem::file_size(file_path, error);
+    size_t capacity = error || file_size == 0 ? 1 << 12 : static_cast<size_t>(file_size);
+    uint8_t* bytes = arena.allocate(capacity);
+    size_t length = 0;
+    read_file_chunks(file_path, 1 << 16, [&](const uint8_t* data, size_t size) {
+        if (size > capacity - length) {
+            capacity = std::max(capacity * 2, length + size);
+            uint8_t* grown = arena.allocate(capacity);
+            std::memcpy(grown, bytes, length);
+            bytes = grown;
+        }
+        std::memcpy(bytes + length, data, size);
+        length += size;
+    });
+    return ByteSpan(bytes, length);
+}
+
+/*
+ * Create an empty arena. No memory is allocated until the first buffer is.
+ */
+ByteArena::ByteArena(size_t block_size) : block_size(block_size), used(0), available(0) {
+}
+
+/*
+ * Return a buffer of size bytes, aligned to a 64-byte cache line. A request
+ * larger than the block size gets a block of its own. Blocks come from the
+ * buffer pool, so an arena that is created and destroyed over and over reuses
+ * the same blocks.
+ */
+uint8_t* ByteArena::allocate(size_t size) {
+    size = (size + 63) / 64 * 64;
+    if (size > available) {
+        blocks.emplace_back(std::max(size, block_size));
+        used = 0;
+        available = blocks.back().capacity();
+    }
+    uint8_t* buffer = blocks.back().data() + used;
+    used += size;
+    available -= size;
+    return buffer;
+}
+
+/*
+ * Free every buffer handed out so far.
+ */
+void ByteArena::reset() {
+    blocks.clear();
+    used = 0;
+    available = 0;
+}
+
+/*
+ * The alignment of the buffers used for reading. Page-aligned buffers let the
+ * kernel copy whole pages into them, and they meet the alignment that direct
+ * I/O needs for buffers, sizes and file offsets on practically every device.
+ */
+static constexpr size_t read_buffer_alignment = 4096;
+
+/*
+ * Take a read buffer from the buffer pool. Reading many files reuses the same
+ * few buffers instead of allocating one for each file, and a buffer of 4096
+ * bytes or more is page-aligned.
+ */
+static PooledBuffer allocate_read_buffer(size_t size) {
+    return PooledBuffer(std::max(size, read_buffer_alignment));
+}
+
+/*
+ * Read from the given file descriptor into the buffer, retrying if the read is
+ * interrupted by a signal. Returns the number of bytes read, which is 0 at the
+ * end of the input, or -1 on error.
+ */
+static long read_some(int fd, uint8_t* buffer, size_t size) {
+#ifdef _WIN32
+    return _read(fd, buffer, static_cast<unsigned int>(std::min<size_t>(size, 1u << 30)));
+#else
+    while (true) {
+        ssize_t count = read(fd, buffer, size);
+        if (count >= 0 || errno != EINTR) {
+            return count;
+        }
+    }
+#endif
+}
+
+/*
+ * Turn off direct I/O on an open file descriptor, so it reads through the page
+ * cache from then on. Returns false if that is not possible.
+ */
+static bool disable_direct_io(int fd) {
+#if !defined(_WIN32) && defined(O_DIRECT)
+    int flags = fcntl(fd, F_GETFL);
+    return flags != -1 && fcntl(fd, F_SETFL, flags & ~O_DIRECT) != -1;
+#else
+    (void) fd;
+    return false;
+#endif
+}
+
+/*
+ * Return true if the file offset of fd is at or past the end of the file.
+ */
+static bool at_end_of_file(int fd) {
+#ifdef _WIN32
+    struct _stat64 info;
+    return _fstat64(fd, &info) == 0 && _lseeki64(fd, 0, SEEK_CUR) >= info.st_size;
+#else
+    struct stat info;
+    return fstat(fd, &info) == 0 && lseek(fd, 0, SEEK_CUR) >= info.st_size;
+#endif
+}
+
+/*
+ * Fill the buffer from the given file descriptor, stopping early only at the
+ * end of the input. Returns the number of bytes read. If direct is set, the
+ * descriptor bypasses the page cache, so every read must start at an aligned
+ * offset. A short read is usually the end of the file, but it can also happen
+ * in the middle, on a signal or on a network file system, and continuing from
+ * there needs an unaligned read. So after a short read direct I/O is turned
+ * off and direct cleared, and reading goes on through the page cache; where
+ * it cannot be turned off, reading only stops if the offset is at the end of
+ * the file, and otherwise goes on and reports any error the device gives. If
+ * the device rejects the alignment anyway, direct I/O is turned off the same
+ * way.
+ */
+static size_t read_full(int fd, uint8_t* buffer, size_t size, bool& direct) {
+    size_t filled = 0;
+    while (filled < size) {
+        size_t requested = size - filled;
+        long count = read_some(fd, buffer + filled, requested);
+        if (count < 0 && direct && errno == EINVAL && disable_direct_io(fd)) {
+            direct = false;
+            continue;
+        }
+        if (count < 0) {
+            throw std::runtime_error(std::string("Error reading input: ")
+                + std::strerror(errno));
+        }
+        if (count == 0) {
+            break;
+        }
+        filled += count;
+        if (direct && static_cast<size_t>(count) < requested) {
+            if (disable_direct_io(fd)) {
+                direct = false;
+            } else if (at_end_of_file(fd)) {
+                break;
+            }
+        }
+    }
+    return filled;
+}
+
+/*
+ * Read everything from an open file descriptor into a ring of queue_depth
+ * buffers on a separate I/O thread, and pass each buffer to the callback on the
+ * calling thread as soon as it is full. While the callback hashes one buffer,
+ * the I/O thread is already reading the next ones, so the latency of the reads
+ * is hidden behind the hashing.
+ */
+static void read_fd_chunks_async(int fd, size_t buffer_size, size_t queue_depth,
+    const std::function<void(const uint8_t*, size_t)>& callback, bool direct) {
+    std::vector<PooledBuffer> buffers;
+    for (size_t i = 0; i < queue_depth; ++i) {
+        buffers.push_back(allocate_read_buffer(buffer_size));
+    }
+    std::vector<size_t> lengths(queue_depth);
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t filled = 0;
+    bool finished = false, cancelled = false;
+    std::exception_ptr error;
+
+    std::thread reader([&] {
+        for (size_t slot = 0; ; slot = (slot + 1) % queue_depth) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return filled < queue_depth || cancelled; });
+                if (cancelled) {
+                    return;
+                }
+            }
+            size_t length = 0;
+            try {
+                length = read_full(fd, buffers[slot].data(), buffer_size, direct);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = std::current_exception();
+                finished = true;
+                changed.notify_all();
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            lengths[slot] = length;
+            if (length > 0) {
+                ++filled;
+            }
+            if (length < buffer_size) {
+                finished = true;
+            }
+            changed.notify_all();
+            if (finished) {
+                return;
+            }
+        }
+    });
+
+    try {
+        for (size_t slot = 0; ; slot = (slot + 1) % queue_depth) {
+            {
+                STATS_TIME(read);
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return filled > 0 || finished; });
+                if (filled == 0) {
+                    break;
+                }
+            }
+            callback(buffers[slot].data(), lengths[slot]);
+            std::lock_guard<std::mutex> lock(mutex);
+            --filled;
+            changed.notify_all();
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cancelled = true;
+            changed.notify_all();
+        }
+        reader.join();
+        throw;
+    }
+    reader.join();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/*
+ * Read everything from an open file descriptor in pieces of at most buffer_size
+ * bytes and pass each piece to the callback. Pieces are only shorter than
+ * buffer_size at the end of the input, so a pipe that delivers small writes
+ * still produces large pieces. With a queue_depth of 2 or more, the reads are
+ * done ahead of time on a separate I/O thread (see read_fd_chunks_async).
+ * Otherwise a single aligned buffer is filled with raw read() calls. Either way
+ * only a fixed number of buffers is held in memory, so input of any size can be
+ * processed in constant memory. direct says whether fd bypasses the page cache
+ * (see read_full).
+ */
+static void read_fd_chunks(int fd, size_t buffer_size,
+    const std::function<void(const uint8_t*, size_t)>& callback, size_t queue_depth,
+    bool direct) {
+    if (queue_depth >= 2) {
+        read_fd_chunks_async(fd, buffer_size, queue_depth, callback, direct);
+        return;
+    }
+    auto buffer = allocate_read_buffer(buffer_size);
+    while (true) {
+        size_t length;
+        {
+            STATS_TIME(read);
+            length = read_full(fd, buffer.data(), buffer_size, direct);
+        }
+        if (length > 0) {
+            callback(buffer.data(), length);
+        }
+        if (length < buffer_size) {
+            return;
+        }
+    }
+}
+
+/*
+ * Open the file at the given path for reading. If direct is set, the file is
+ * opened for direct I/O, bypassing the page cache: O_DIRECT on Linux,
+ * F_NOCACHE on macOS and FILE_FLAG_NO_BUFFERING on Windows. If that is not
+ * possible, for example on a file system without direct I/O such as tmpfs,
+ * the file is opened normally and direct is cleared. Returns -1 if the file
+ * cannot be opened at all.
+ */
+static int open_for_reading(const std::string& file_path, bool& direct) {
+#ifdef _WIN32
+    if (direct) {
+        HANDLE handle = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (handle != INVALID_HANDLE_VALUE) {
+            int fd = _open_osfhandle(reinterpret_cast<intptr_t>(handle), _O_RDONLY | _O_BINARY);
+            if (fd >= 0) {
+                return fd;
+            }
+            CloseHandle(handle);
+        }
+        direct = false;
+    }
+    return _open(file_path.c_str(), _O_RDONLY | _O_BINARY | _O_SEQUENTIAL);
+#else
+    if (direct) {
+#if defined(O_DIRECT)
+        int fd = open(file_path.c_str(), O_RDONLY | O_DIRECT);
+        if (fd >= 0) {
+            return fd;
+        }
+#elif defined(F_NOCACHE)
+        int fd = open(file_path.c_str(), O_RDONLY);
+        if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) != -1) {
+            return fd;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+        direct = false;
+    }
+    return open(file_path.c_str(), O_RDONLY);
+#endif
+}
+
+/*
+ * Given the path to a file on the filesystem, read the contents of the file
+ * in pieces of at most chunk_size bytes and pass each piece to the callback.
+ * Only a fixed number of chunks is held in memory at a time, so files of any
+ * size can be processed in constant memory. With a queue_depth of 2 or more,
+ * the next chunks are read on an I/O thread while the callback runs. Reading
+ * starts at the given byte offset into the file.
+ *
+ * With direct, the file is read with direct I/O, so a bulk scan neither evicts
+ * the page cache nor is limited by it. Direct I/O needs an aligned chunk size
+ * and offset; if they are not multiples of 4096 bytes, or the file system does
+ * not support it, the file is read normally.
+ */
+void read_file_chunks(const std::string& file_path, size_t chunk_size,
+    const std::function<void(const uint8_t*, size_t)>& callback, size_t queue_depth,
+    uint64_t offset, bool direct) {
+    direct = direct && chunk_size % read_buffer_alignment == 0
+        && offset % read_buffer_alignment == 0;
+    int fd = open_for_reading(file_path, direct);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file: " + file_path);
+    }
+    try {
+#ifdef _WIN32
+        bool seeked = offset == 0 || _lseeki64(fd, offset, SEEK_SET) >= 0;
+#else
+        bool seeked = offset == 0 || lseek(fd, offset, SEEK_SET) >= 0;
+#endif
+        if (!seeked) {
+            throw std::runtime_error("Unable to seek in file: " + file_path);
+        }
+        read_fd_chunks(fd, chunk_size, callback, queue_depth, direct);
+    } catch (...) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+        throw;
+    }
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+/*
+ * Read up to size bytes of the file at the given path, starting at the given
+ * byte offset, into the buffer. Returns the number of bytes read, which is
+ * less than size only if the end of the file was reached.
+ */
+size_t read_file_range(const std::string& file_path, uint64_t offset, uint8_t* buffer,
+    size_t size) {
+    STATS_TIME(read);
+#ifdef _WIN32
+    int fd = _open(file_path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = open(file_path.c_str(), O_RDONLY);
+#endif
+    if (fd < 0) {
         throw std::runtime_error("Unable to open file: " + file_path);
     }
-    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file),
-        std::istreambuf_iterator<char>());
+    size_t length = 0;
+    try {
+#ifdef _WIN32
+        bool seeked = offset == 0 || _lseeki64(fd, offset, SEEK_SET) >= 0;
+#else
+        bool seeked = offset == 0 || lseek(fd, offset, SEEK_SET) >= 0;
+#endif
+        if (!seeked) {
+            throw std::runtime_error("Unable to seek in file: " + file_path);
+        }
+        bool direct = false;
+        length = read_full(fd, buffer, size, direct);
+    } catch (...) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+        throw;
+    }
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+    return length;
+}
+
+/*
+ * Read everything from standard input in pieces of at most buffer_size bytes
+ * and pass each piece to the callback, reading ahead with queue_depth buffers
+ * if queue_depth is 2 or more.
+ */
+void read_stdin_chunks(size_t buffer_size,
+    const std::function<void(const uint8_t*, size_t)>& callback, size_t queue_depth) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    read_fd_chunks(_fileno(stdin), buffer_size, callback, queue_depth, false);
+#else
+    read_fd_chunks(STDIN_FILENO, buffer_size, callback, queue_depth, false);
+#endif
 }
 
 /*
  * Given a path to a file on the filesystem and a string, write the string to
  * the file.
  */
-void write_file(const std::string& filename, const std::string& contents) {
+void write_file(const std::string& filename, std::string_view contents) {
     std::ofstream file(filename);
     if (!file) {
         throw std::runtime_error("Unable to open file: " + filename);
@@ -69,13 +528,489 @@ void write_file(const std::string& filename, const std::string& contents) {
 }
 
 /*
- * Given a vector of bytes, convert the bytes to a string of hex characters.
+ * Write all of the bytes to the given file descriptor and flush them to the
+ * device. Returns false on error.
+ */
+static bool write_and_sync(int fd, ByteSpan contents) {
+    const uint8_t* data = contents.data();
+    size_t length = contents.size();
+    while (length > 0) {
+#ifdef _WIN32
+        long count = _write(fd, data, static_cast<unsigned int>(std::min<size_t>(length, 1u << 30)));
+#else
+        ssize_t count = ::write(fd, data, length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        length -= count;
+    }
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+/*
+ * Write the bytes to the file at the given path so that the change is atomic:
+ * the bytes are written to a temporary file in the same directory and synced
+ * to the device, and the file is then renamed over the target. Anyone reading
+ * the file sees either the old contents or the new contents, never a partially
+ * written file, and a crash after the rename cannot leave the target empty.
  */
-std::string to_hex_string(const std::vector<uint8_t>& bytes) {
-    std::ostringstream stream;
-    for (uint8_t byte : bytes) {
-        stream << std::hex << std::setw(2) << std::setfill('0')
-            << static_cast<int>(byte);
+void write_file_atomic(const std::string& filename, ByteSpan contents) {
+    std::random_device random;
+    std::string temporary = filename + ".tmp" + std::to_string(random());
+#ifdef _WIN32
+    int fd = _open(temporary.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, 0644);
+#else
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+#endif
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file: " + temporary);
+    }
+    bool written = write_and_sync(fd, contents);
+#ifdef _WIN32
+    written = _close(fd) == 0 && written;
+#else
+    written = close(fd) == 0 && written;
+#endif
+    if (!written) {
+        std::error_code error;
+        std::filesystem::remove(temporary, error);
+        throw std::runtime_error("Unable to write file: " + temporary);
     }
-    return stream.str();
+    std::filesystem::rename(temporary, filename);
+#ifndef _WIN32
+    std::string directory = std::filesystem::path(filename).parent_path().string();
+    int directory_fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (directory_fd >= 0) {
+        fsync(directory_fd);
+        close(directory_fd);
+    }
+#endif
 }
+
+/*
+ * Open or create the lock file and wait until this process holds an exclusive
+ * lock on it.
+ */
+FileLock::FileLock(const std::string& filename) {
+#ifdef _WIN32
+    fd = _open(filename.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, 0644);
+#else
+    fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+#endif
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open lock file: " + filename);
+    }
+#ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    bool locked = LockFileEx(reinterpret_cast<HANDLE>(_get_osfhandle(fd)), LOCKFILE_EXCLUSIVE_LOCK,
+        0, MAXDWORD, MAXDWORD, &overlapped) != 0;
+#else
+    int status;
+    do {
+        status = flock(fd, LOCK_EX);
+    } while (status != 0 && errno == EINTR);
+    bool locked = status == 0;
+#endif
+    if (!locked) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+        throw std::runtime_error("Unable to lock file: " + filename);
+    }
+}
+
+/*
+ * Release the lock by closing the lock file. The file itself is left in
+ * place, since removing it could let two processes lock different files.
+ */
+FileLock::~FileLock() {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+/*
+ * Open a sink that writes to the given file, or to standard output if filename
+ * is empty. The file is created or truncated.
+ */
+OutputSink::OutputSink(const std::string& filename, size_t buffer_size)
+    : buffer(new char[buffer_size]), capacity(buffer_size), used(0), fd(1),
+      owns_fd(false), filename(filename.empty() ? "standard output" : filename) {
+    if (filename.empty()) {
+        std::cout << std::flush;
+#ifdef _WIN32
+        _setmode(1, _O_BINARY);
+#endif
+        return;
+    }
+#ifdef _WIN32
+    fd = _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+    fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file: " + filename);
+    }
+    owns_fd = true;
+}
+
+/*
+ * Flush any buffered output and close the file.
+ */
+OutputSink::~OutputSink() {
+    try {
+        flush();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+    if (owns_fd) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+    }
+}
+
+/*
+ * Add length bytes to the output. Writes larger than the buffer bypass it.
+ */
+void OutputSink::write(const char* data, size_t length) {
+    if (length > capacity - used) {
+        flush();
+        if (length >= capacity) {
+            write_all(data, length);
+            return;
+        }
+    }
+    std::memcpy(buffer.get() + used, data, length);
+    used += length;
+}
+
+void OutputSink::write(std::string_view text) {
+    write(text.data(), text.size());
+}
+
+/*
+ * Write everything in the buffer to the file.
+ */
+void OutputSink::flush() {
+    write_all(buffer.get(), used);
+    used = 0;
+}
+
+/*
+ * Write length bytes directly to the file, retrying partial writes.
+ */
+void OutputSink::write_all(const char* data, size_t length) {
+    while (length > 0) {
+#ifdef _WIN32
+        long count = _write(fd, data, static_cast<unsigned int>(std::min<size_t>(length, 1u << 30)));
+#else
+        ssize_t count = ::write(fd, data, length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (count <= 0) {
+            throw std::runtime_error("Unable to write to " + filename);
+        }
+        data += count;
+        length -= count;
+    }
+}
+
+/*
+ * Prepare to write count results to the given sink.
+ */
+OrderedOutput::OrderedOutput(OutputSink& sink, size_t count)
+    : sink(sink), slots(count), ready(new std::atomic<bool>[count]), next(0) {
+    for (size_t i = 0; i < count; ++i) {
+        ready[i].store(false, std::memory_order_relaxed);
+    }
+}
+
+/*
+ * Store the result with the given index, and write it and any results after it
+ * that are ready if it is the next one due.
+ */
+void OrderedOutput::complete(size_t index, std::string text) {
+    slots[index] = std::move(text);
+    ready[index].store(true, std::memory_order_release);
+    if (index == next.load(std::memory_order_acquire)) {
+        drain();
+    }
+}
+
+/*
+ * Write every result that has not been written yet. All results must have been
+ * completed.
+ */
+void OrderedOutput::finish() {
+    drain();
+    sink.flush();
+}
+
+/*
+ * Write results in order for as long as the next one is ready. Only one thread
+ * drains at a time; a thread that finds another one draining leaves the work to
+ * it. After releasing the lock, the next result is checked once more, in case
+ * it was completed while the lock was held and its thread gave up.
+ */
+void OrderedOutput::drain() {
+    while (true) {
+        if (!drain_mutex.try_lock()) {
+            return;
+        }
+        size_t index = next.load(std::memory_order_relaxed);
+        while (index < slots.size() && ready[index].load(std::memory_order_acquire)) {
+            sink.write(slots[index]);
+            std::string().swap(slots[index]);
+            ++index;
+        }
+        next.store(index, std::memory_order_release);
+        drain_mutex.unlock();
+        if (index == slots.size() || !ready[index].load(std::memory_order_acquire)) {
+            return;
+        }
+    }
+}
+
+/*
+ * A table of the two lowercase hex characters for every byte value, so a byte
+ * is converted with a single lookup instead of stream formatting.
+ */
+static constexpr struct HexEncodeTable {
+    char pairs[512];
+    constexpr HexEncodeTable() : pairs() {
+        const char digits[] = "0123456789abcdef";
+        for (int i = 0; i < 256; ++i) {
+            pairs[i * 2] = digits[i >> 4];
+            pairs[i * 2 + 1] = digits[i & 0xf];
+        }
+    }
+} hex_encode_table;
+
+/*
+ * A table of the value of every hex character, in upper or lower case. Every
+ * other character maps to -1.
+ */
+static constexpr struct HexDecodeTable {
+    int8_t values[256];
+    constexpr HexDecodeTable() : values() {
+        for (int i = 0; i < 256; ++i) {
+            values[i] = i >= '0' && i <= '9' ? i - '0'
+                : i >= 'a' && i <= 'f' ? i - 'a' + 10
+                : i >= 'A' && i <= 'F' ? i - 'A' + 10 : -1;
+        }
+    }
+} hex_decode_table;
+
+/*
+ * Given length bytes, write their 2 * length lowercase hex characters to out.
+ * No terminating null character is written.
+ */
+void hex_encode(const uint8_t* bytes, size_t length, char* out) {
+    for (size_t i = 0; i < length; ++i) {
+        std::memcpy(out + i * 2, hex_encode_table.pairs + bytes[i] * 2, 2);
+    }
+}
+
+/*
+ * Given length hex characters, write the length / 2 bytes they encode to out.
+ * Returns false if length is odd or any character is not a hex digit.
+ */
+bool hex_decode(const char* hex, size_t length, uint8_t* out) {
+    if (length % 2 != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i += 2) {
+        int high = hex_decode_table.values[static_cast<uint8_t>(hex[i])];
+        int low = hex_decode_table.values[static_cast<uint8_t>(hex[i + 1])];
+        if ((high | low) < 0) {
+            return false;
+        }
+        out[i / 2] = static_cast<uint8_t>((high << 4) | low);
+    }
+    return true;
+}
+
+/*
+ * Given a view of bytes, convert the bytes to a string of hex characters.
+ */
+std::string to_hex_string(ByteSpan bytes) {
+    std::string hex(bytes.size() * 2, '\0');
+    hex_encode(bytes.data(), bytes.size(), hex.data());
+    return hex;
+}
+
+#ifdef _WIN32
+
+/*
+ * Map the file at the given path into memory. If the file is not a regular
+ * disk file, or is too large for the address space, the file is left unmapped.
+ */
+MappedFile::MappedFile(const std::string& filename)
+    : view(nullptr), length(0), mapped(false), file_handle(INVALID_HANDLE_VALUE),
+      mapping_handle(nullptr) {
+    STATS_TIME(read);
+    file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Unable to open file: " + filename);
+    }
+    map();
+}
+
+/*
+ * Map the open file, unless it is not a regular disk file or is too large for
+ * the address space.
+ */
+void MappedFile::map() {
+    LARGE_INTEGER file_size;
+    if (GetFileType(file_handle) != FILE_TYPE_DISK || !GetFileSizeEx(file_handle, &file_size)
+        || (uint64_t) file_size.QuadPart > std::numeric_limits<size_t>::max()) {
+        return;
+    }
+    length = static_cast<size_t>(file_size.QuadPart);
+    mapped = true;
+    if (length == 0) {
+        return;
+    }
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle != nullptr) {
+        view = static_cast<const uint8_t*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (view == nullptr) {
+        length = 0;
+        mapped = false;
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+    }
+    if (mapping_handle != nullptr) {
+        CloseHandle(mapping_handle);
+    }
+    CloseHandle(file_handle);
+}
+
+/*
+ * Read the file from the given byte offset to its end in chunks, as
+ * read_file_chunks does, through a descriptor for the handle that is already
+ * open.
+ */
+void MappedFile::read_chunks(size_t chunk_size,
+    const std::function<void(const uint8_t*, size_t)>& callback, size_t queue_depth,
+    uint64_t offset) const {
+    HANDLE duplicate;
+    if (!DuplicateHandle(GetCurrentProcess(), file_handle, GetCurrentProcess(), &duplicate, 0,
+        FALSE, DUPLICATE_SAME_ACCESS)) {
+        throw std::runtime_error("Unable to read file");
+    }
+    int fd = _open_osfhandle(reinterpret_cast<intptr_t>(duplicate), _O_RDONLY | _O_BINARY);
+    if (fd < 0) {
+        CloseHandle(duplicate);
+        throw std::runtime_error("Unable to read file");
+    }
+    try {
+        if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+            throw std::runtime_error("Unable to seek in file");
+        }
+        read_fd_chunks(fd, chunk_size, callback, queue_depth, false);
+    } catch (...) {
+        _close(fd);
+        throw;
+    }
+    _close(fd);
+}
+
+#else
+
+/*
+ * Map the file at the given path into memory. The kernel is told that the file
+ * will be read sequentially, so it reads ahead aggressively and drops pages
+ * behind the reader. If the file is not a regular file, or is too large for the
+ * address space, the file is left unmapped.
+ */
+MappedFile::MappedFile(const std::string& filename)
+    : view(nullptr), length(0), mapped(false), fd(-1) {
+    STATS_TIME(read);
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file: " + filename);
+    }
+    map();
+}
+
+/*
+ * Map the file open on fd, which the MappedFile takes over and closes.
+ */
+MappedFile::MappedFile(int fd)
+    : view(nullptr), length(0), mapped(false), fd(fd) {
+    STATS_TIME(read);
+    map();
+}
+
+/*
+ * Map the open file, unless it is not a regular file or is too large for the
+ * address space.
+ */
+void MappedFile::map() {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)
+        || (uintmax_t) info.st_size > std::numeric_limits<size_t>::max()) {
+        return;
+    }
+    length = static_cast<size_t>(info.st_size);
+    mapped = true;
+    if (length == 0) {
+        return;
+    }
+    void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+        length = 0;
+        mapped = false;
+        return;
+    }
+    madvise(address, length, MADV_SEQUENTIAL);
+    view = static_cast<const uint8_t*>(address);
+}
+
+MappedFile::~MappedFile() {
+    if (view != nullptr) {
+        munmap(const_cast<uint8_t*>(view), length);
+    }
+    close(fd);
+}
+
+/*
+ * Read the file from the given byte offset to its end in chunks, as
+ * read_file_chunks does, from the descriptor that is already open. A pipe or
+ * other special file is read once, by this reader, rather than opened again.
+ */
+void MappedFile::read_chunks(size_t chunk_size,
+    const std::function<void(const uint8_t*, size_t)>& callback, size_t queue_depth,
+    uint64_t offset) const {
+    if (offset != 0 && lseek(fd, offset, SEEK_SET) < 0) {
+        throw std::runtime_error("Unable to seek in file");
+    }
+    read_fd_chunks(fd, chunk_size, callback, queue_depth, false);
+}
+
+#endif
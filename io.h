@@ -1,12 +1,166 @@
 #pragma once
 
+#include "buffer_pool.h"
+#include "byte_span.h"
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstdint>
 #include <map>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 std::map<std::string, std::string> parse_args(int argc, char** argv,
     const std::vector<std::string>& accepted_args, const std::string& usage);
+/*
+ * An arena that hands out buffers which live until the arena is reset or
+ * destroyed. Buffers are carved from blocks of at least block_size bytes, so
+ * many small buffers, such as the contents of small files or the lines parsed
+ * from them, cost one allocation per block rather than one each, and are all
+ * freed at once. An arena is not thread-safe.
+ */
+class ByteArena {
+public:
+    explicit ByteArena(size_t block_size = 1 << 16);
+
+    ByteArena(const ByteArena&) = delete;
+    ByteArena& operator=(const ByteArena&) = delete;
+
+    uint8_t* allocate(size_t size);
+    void reset();
+
+private:
+    std::vector<PooledBuffer> blocks;
+    size_t block_size;
+    size_t used;
+    size_t available;
+};
+
 std::vector<uint8_t> read_file_bytes(const std::string& filename);
-void write_file(const std::string& filename, const std::string& contents);
-std::string to_hex_string(const std::vector<uint8_t>& bytes);
+ByteSpan read_file_bytes(const std::string& filename, ByteArena& arena);
+void read_file_chunks(const std::string& filename, size_t chunk_size,
+    const std::function<void(const uint8_t*, size_t)>& callback, size_t queue_depth = 0,
+    uint64_t offset = 0, bool direct = false);
+size_t read_file_range(const std::string& filename, uint64_t offset, uint8_t* buffer,
+    size_t size);
+void read_stdin_chunks(size_t buffer_size,
+    const std::function<void(const uint8_t*, size_t)>& callback, size_t queue_depth = 0);
+void write_file(const std::string& filename, std::string_view contents);
+void write_file_atomic(const std::string& filename, ByteSpan contents);
+std::string to_hex_string(ByteSpan bytes);
+void hex_encode(const uint8_t* bytes, size_t length, char* out);
+bool hex_decode(const char* hex, size_t length, uint8_t* out);
+
+/*
+ * A read-only, memory-mapped view of the contents of a file. Mapping lets the
+ * file be hashed directly from the page cache without copying it into memory.
+ * Only regular files can be mapped; for pipes and other special files,
+ * is_mapped() returns false and the file should be streamed with read_chunks,
+ * which reads from the file already opened rather than opening the path again.
+ * On POSIX systems a MappedFile can also take over a file descriptor the caller
+ * has opened and checked.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+#ifndef _WIN32
+    explicit MappedFile(int fd);
+#endif
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool is_mapped() const { return mapped; }
+    const uint8_t* data() const { return view; }
+    size_t size() const { return length; }
+
+    void read_chunks(size_t chunk_size,
+        const std::function<void(const uint8_t*, size_t)>& callback, size_t queue_depth = 0,
+        uint64_t offset = 0) const;
+
+private:
+    void map();
+
+    const uint8_t* view;
+    size_t length;
+    bool mapped;
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#else
+    int fd;
+#endif
+};
+
+/*
+ * An exclusive advisory lock on a lock file, held from construction until
+ * destruction, for serializing a read-modify-write of a shared file between
+ * processes. Waits for any other holder to release the lock.
+ */
+class FileLock {
+public:
+    explicit FileLock(const std::string& filename);
+    ~FileLock();
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+private:
+    int fd;
+};
+
+/*
+ * A buffered output sink for standard output or a file. Writes are collected in
+ * a large buffer and written with one system call whenever the buffer fills, so
+ * writing millions of short lines costs only a few system calls. The sink is
+ * not thread-safe; use OrderedOutput to write from several threads.
+ */
+class OutputSink {
+public:
+    explicit OutputSink(const std::string& filename = "", size_t buffer_size = 1 << 20);
+    ~OutputSink();
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    void write(const char* data, size_t length);
+    void write(std::string_view text);
+    void flush();
+
+private:
+    void write_all(const char* data, size_t length);
+
+    std::unique_ptr<char[]> buffer;
+    size_t capacity;
+    size_t used;
+    int fd;
+    bool owns_fd;
+    std::string filename;
+};
+
+/*
+ * Writes count results to an OutputSink in index order, while the results are
+ * completed in any order by any number of threads. Each result is stored in its
+ * own slot without taking a lock. Whichever thread completes the next result
+ * due to be written drains every result that is ready from that point on, so
+ * output is written as soon as it can be without reordering.
+ */
+class OrderedOutput {
+public:
+    OrderedOutput(OutputSink& sink, size_t count);
+
+    void complete(size_t index, std::string text);
+    void finish();
+
+private:
+    void drain();
+
+    OutputSink& sink;
+    std::vector<std::string> slots;
+    std::unique_ptr<std::atomic<bool>[]> ready;
+    std::atomic<size_t> next;
+    std::mutex drain_mutex;
+};
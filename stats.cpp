@@ -0,0 +1,98 @@
+#include "stats.h"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+bool stats_on = false;
+
+/*
+ * The counters of every thread that has recorded anything, in the order the
+ * threads first did so. Counters outlive their threads, so work done by a pool
+ * that has already been destroyed is still reported.
+ */
+static std::mutex registry_mutex;
+static std::vector<std::unique_ptr<ThreadStats>> registry;
+
+/*
+ * Start collecting stats. This must be called before any hashing starts.
+ */
+void stats_enable() {
+    stats_on = true;
+}
+
+/*
+ * Return the counters of the calling thread, registering them on first use.
+ */
+ThreadStats& thread_stats() {
+    thread_local ThreadStats* stats = [] {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(std::make_unique<ThreadStats>());
+        return registry.back().get();
+    }();
+    return *stats;
+}
+
+/*
+ * Format one line of the report: the byte and block counts, then the time spent
+ * in each stage. The rate for the compress stage is the rate of the block
+ * function alone, ignoring time spent reading and padding.
+ */
+static std::string stats_line(uint64_t files, uint64_t bytes, uint64_t blocks,
+    const uint64_t nanoseconds[]) {
+    static const char* const stage_names[] = {"read", "pad", "compress"};
+    char text[256];
+    int length = std::snprintf(text, sizeof(text), "%llu files, %llu bytes, %llu blocks",
+        (unsigned long long) files, (unsigned long long) bytes, (unsigned long long) blocks);
+    for (int stage = 0; stage < static_cast<int>(Stage::count); ++stage) {
+        length += std::snprintf(text + length, sizeof(text) - length, ", %s %.3f s",
+            stage_names[stage], nanoseconds[stage] / 1e9);
+    }
+    double compress_seconds = nanoseconds[static_cast<int>(Stage::compress)] / 1e9;
+    if (compress_seconds > 0) {
+        std::snprintf(text + length, sizeof(text) - length, " (%.1f MB/s)",
+            bytes / compress_seconds / 1e6);
+    }
+    return text;
+}
+
+/*
+ * Write the totals over all threads, the wall time and the overall rate, and a
+ * line per thread if more than one thread did any work.
+ */
+void stats_report(std::ostream& out, double wall_seconds) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    uint64_t files = 0, bytes = 0, blocks = 0;
+    uint64_t total[static_cast<int>(Stage::count)] = {};
+    std::vector<std::string> thread_lines;
+    for (const auto& stats : registry) {
+        uint64_t thread_nanoseconds[static_cast<int>(Stage::count)];
+        uint64_t busy = 0;
+        for (int stage = 0; stage < static_cast<int>(Stage::count); ++stage) {
+            thread_nanoseconds[stage] = stats->stage_nanoseconds[stage].load(
+                std::memory_order_relaxed);
+            total[stage] += thread_nanoseconds[stage];
+            busy += thread_nanoseconds[stage];
+        }
+        uint64_t thread_files = stats->files.load(std::memory_order_relaxed);
+        uint64_t thread_bytes = stats->bytes.load(std::memory_order_relaxed);
+        uint64_t thread_blocks = stats->blocks.load(std::memory_order_relaxed);
+        files += thread_files;
+        bytes += thread_bytes;
+        blocks += thread_blocks;
+        if (busy > 0 || thread_blocks > 0) {
+            thread_lines.push_back(stats_line(thread_files, thread_bytes, thread_blocks,
+                thread_nanoseconds));
+        }
+    }
+    char wall[128];
+    std::snprintf(wall, sizeof(wall), "%.3f s wall, %.1f MB/s", wall_seconds,
+        wall_seconds > 0 ? bytes / wall_seconds / 1e6 : 0.0);
+    out << "stats: " << stats_line(files, bytes, blocks, total) << ", " << wall << "\n";
+    if (thread_lines.size() > 1) {
+        for (size_t i = 0; i < thread_lines.size(); ++i) {
+            out << "stats: thread " << i << ": " << thread_lines[i] << "\n";
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/*
+ * Counters and timers for the hot paths, reported with --stats. Building with
+ * -DHASH_STATS=0 compiles every STATS_ macro below to nothing, so the hot paths
+ * carry no trace of them. Otherwise the timers only read the clock once stats
+ * have been turned on with stats_enable(), so a build with stats enabled costs
+ * a predictable branch per timed call until they are.
+ */
+#ifndef HASH_STATS
+#define HASH_STATS 1
+#endif
+
+/*
+ * The stages that time is attributed to. Reading is the time spent waiting for
+ * input (system calls, mapping a file, or waiting for the read-ahead thread);
+ * padding is building and hashing the final blocks of each message;
+ * compressing is running the block function over the message.
+ */
+enum class Stage { read, pad, compress, count };
+
+/*
+ * The counters of one thread. Each thread only ever writes its own counters, so
+ * they are updated with relaxed loads and stores rather than atomic
+ * read-modify-write instructions; they are atomic only so that a report taken
+ * while other threads are alive is not a data race.
+ */
+struct ThreadStats {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> stage_nanoseconds[static_cast<int>(Stage::count)] = {};
+};
+
+/*
+ * Whether stats are being collected. This is set by stats_enable() before any
+ * hashing starts and never changes afterwards.
+ */
+extern bool stats_on;
+
+inline bool stats_enabled() {
+    return stats_on;
+}
+
+void stats_enable();
+ThreadStats& thread_stats();
+void stats_report(std::ostream& out, double wall_seconds);
+
+/*
+ * Add value to one of the calling thread's counters.
+ */
+inline void stats_add(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/*
+ * Adds the time between its construction and destruction to a stage of the
+ * calling thread, if stats are enabled.
+ */
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage) : stage(stage), enabled(stats_enabled()) {
+        if (enabled) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~StageTimer() {
+        if (enabled) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            stats_add(thread_stats().stage_nanoseconds[static_cast<int>(stage)],
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    Stage stage;
+    bool enabled;
+    std::chrono::steady_clock::time_point start;
+};
+
+#if HASH_STATS
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+#define STATS_TIME(stage) StageTimer STATS_CONCAT(stage_timer_, __LINE__)(Stage::stage)
+#define STATS_ADD(counter, value) \
+    do { if (stats_enabled()) stats_add(thread_stats().counter, (value)); } while (0)
+#else
+#define STATS_TIME(stage) do { } while (0)
+#define STATS_ADD(counter, value) do { } while (0)
+#endif
@@ -0,0 +1,139 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+/*
+ * The pool the current thread works for and its index in that pool, or
+ * nullptr and -1 if the current thread is not a pool worker. The owner is
+ * kept with the index because a worker of one pool can submit to another.
+ */
+struct CurrentWorker {
+    const ThreadPool* owner;
+    long index;
+};
+
+static thread_local CurrentWorker current_worker = {nullptr, -1};
+
+/*
+ * Start a pool with the given number of worker threads. If thread_count is 0,
+ * one worker is started for each hardware thread.
+ */
+ThreadPool::ThreadPool(size_t thread_count)
+    : queued(0), unfinished(0), next_queue(0), stopping(false) {
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+/*
+ * Wait for all queued tasks to finish, then stop the worker threads.
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        all_done.wait(lock, [this] { return unfinished == 0; });
+        stopping = true;
+    }
+    task_available.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+/*
+ * Queue a task to be run by the pool. Tasks submitted by a worker of this pool
+ * go to that worker's own queue; other tasks, including those submitted by
+ * workers of another pool, are spread over the queues in turn.
+ */
+void ThreadPool::submit(std::function<void()> task) {
+    size_t index = current_worker.owner == this ? current_worker.index
+        : next_queue++ % queues.size();
+    ++unfinished;
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++queued;
+    }
+    task_available.notify_one();
+}
+
+/*
+ * Block until every task submitted so far has finished. If a task threw an
+ * exception, the first such exception is rethrown here.
+ */
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this] { return unfinished == 0; });
+    if (error) {
+        std::exception_ptr first_error = error;
+        error = nullptr;
+        std::rethrow_exception(first_error);
+    }
+}
+
+/*
+ * Take the next task for the given worker: the newest task in its own queue,
+ * or failing that the oldest task in another worker's queue. Returns false if
+ * every queue is empty.
+ */
+bool ThreadPool::pop_task(size_t index, std::function<void()>& task) {
+    {
+        WorkQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+        WorkQueue& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * The main loop of a worker thread. The worker runs tasks until its own queue
+ * and every other queue is empty, then sleeps until more tasks are submitted.
+ */
+void ThreadPool::worker_loop(size_t index) {
+    current_worker = {this, static_cast<long>(index)};
+    while (true) {
+        std::function<void()> task;
+        if (pop_task(index, task)) {
+            --queued;
+            try {
+                task();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            if (--unfinished == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                all_done.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        task_available.wait(lock, [this] { return queued > 0 || stopping; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
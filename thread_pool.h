@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed-size pool of worker threads with work stealing. Each worker has its
+ * own queue of tasks. A worker runs tasks from the back of its own queue, and
+ * when that is empty it steals from the front of the other workers' queues, so
+ * no worker sits idle while there is work queued anywhere in the pool.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    void wait();
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void worker_loop(size_t index);
+    bool pop_task(size_t index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable task_available;
+    std::condition_variable all_done;
+    std::atomic<size_t> queued;
+    std::atomic<size_t> unfinished;
+    std::atomic<size_t> next_queue;
+    std::exception_ptr error;
+    bool stopping;
+};